@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Minimal microbenchmark harness. Each benchmark is a callable that runs a given number
+// of iterations; the runner grows the number of iterations until a run takes at least
+// the minimum time, and reports the time per iteration of the best of a few such runs.
+//
+// Results are printed as a table, and can be written as JSON for regression tracking:
+//
+//   {"benchmarks": [{"name": "...", "threads": 1, "iterations": 1048576,
+//                    "ns_per_op": 1.23, "total_ms": 1.29}, ...]}
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fmt/format.h>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <algorithms/error.h>
+
+namespace algorithms::benchmark {
+
+// Keep the compiler from optimizing away a value or the computation leading to it
+template <class T> inline void doNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class Runner {
+public:
+  struct Result {
+    std::string name;
+    size_t threads;
+    size_t iterations; // per thread
+    double ns_per_op;  // wall time per iteration (of each thread)
+    double total_ms;   // wall time of the reported run
+  };
+
+  explicit Runner(const double min_time_s = 0.2, const size_t repetitions = 3)
+      : m_min_time{min_time_s}, m_repetitions{repetitions} {}
+
+  // Benchmark body(n), which runs n iterations, on nthreads concurrent threads
+  void run(const std::string& name, const std::function<void(size_t)>& body,
+           const size_t nthreads = 1) {
+    size_t n    = 1;
+    double time = timeRun(body, n, nthreads);
+    while (time < m_min_time && n < (size_t(1) << 40)) {
+      // aim slightly above the minimum time, but grow by at most 10x per step
+      const double factor = time > 0 ? std::min(10., 1.5 * m_min_time / time) : 10.;
+      n                   = std::max(n + 1, static_cast<size_t>(n * factor));
+      time                = timeRun(body, n, nthreads);
+    }
+    for (size_t r = 1; r < m_repetitions; ++r) {
+      time = std::min(time, timeRun(body, n, nthreads));
+    }
+    record({name, nthreads, n, time * 1e9 / n, time * 1e3});
+  }
+  // One-shot measurement, for steps that can only run once per process
+  void once(const std::string& name, const std::function<void()>& body) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    record({name, 1, 1, time.count() * 1e9, time.count() * 1e3});
+  }
+
+  const std::vector<Result>& results() const { return m_results; }
+
+  void writeJson(const std::string& path) const {
+    std::ofstream out{path};
+    if (!out) {
+      throw Error(fmt::format("Failed to open {} to write the benchmark results", path),
+                  "algorithms::benchmark::Runner");
+    }
+    out << "{\"benchmarks\": [";
+    for (size_t i = 0; i < m_results.size(); ++i) {
+      const auto& r = m_results[i];
+      out << fmt::format("{}\n  {{\"name\": \"{}\", \"threads\": {}, \"iterations\": {}, "
+                         "\"ns_per_op\": {:.4f}, \"total_ms\": {:.4f}}}",
+                         i ? "," : "", r.name, r.threads, r.iterations, r.ns_per_op, r.total_ms);
+    }
+    out << "\n]}\n";
+  }
+
+private:
+  static double timeRun(const std::function<void(size_t)>& body, const size_t n,
+                        const size_t nthreads) {
+    const auto start = std::chrono::steady_clock::now();
+    if (nthreads == 1) {
+      body(n);
+    } else {
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&] { body(n); });
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+    }
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    return time.count();
+  }
+  void record(Result r) {
+    fmt::print("{:<48} {:>3} threads {:>12} iterations {:>12.2f} ns/op\n", r.name, r.threads,
+               r.iterations, r.ns_per_op);
+    m_results.push_back(std::move(r));
+  }
+
+  const double m_min_time;
+  const size_t m_repetitions;
+  std::vector<Result> m_results;
+};
+
+} // namespace algorithms::benchmark
@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Microbenchmarks of the per-event overhead added by the core library itself.
+//
+// Usage: algorithms_benchmarks [--json <file>] [--min-time <seconds>] [--threads <N>]
+//
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <algorithms/algorithm.h>
+#include <algorithms/detail/sharded_cache.h>
+#include <algorithms/histogram.h>
+#include <algorithms/logger.h>
+#include <algorithms/property.h>
+#include <algorithms/random.h>
+#include <algorithms/service.h>
+#include <algorithms/trace.h>
+
+#include "benchmark.h"
+
+using namespace algorithms;
+using algorithms::benchmark::doNotOptimize;
+using algorithms::benchmark::Runner;
+
+namespace {
+
+// Trivial algorithm, so only the dispatch and argument handling are measured
+class SumAlgorithm : public Algorithm<Input<double, std::optional<double>, std::vector<double>>,
+                                      Output<double>> {
+public:
+  SumAlgorithm() : Algorithm{"SumAlgorithm", {"a", "b", "c"}, {"sum"}, "Benchmark algorithm"} {}
+  void process(const Input& input, const Output& output) const final {
+    const auto& [a, b, c] = input;
+    const auto [sum]      = output;
+    *sum                  = *a + (b ? *b : 0.);
+    for (const auto& v : c) {
+      *sum += *v;
+    }
+  }
+};
+
+// Algorithm that rejects every event, either by raising or through a Status
+class RejectAlgorithm : public Algorithm<Input<double>, Output<double>> {
+public:
+  RejectAlgorithm() : Algorithm{"RejectAlgorithm", {"a"}, {"b"}, "Benchmark algorithm"} {
+    maxReports(0);
+    level(LogLevel::kCritical);
+  }
+  void process(const Input&, const Output&) const final { raise("rejected"); }
+  Status tryProcess(const Input&, const Output&) const final { return skip("rejected"); }
+};
+
+// Exposes the protected logger calls
+class BenchLogger : public LoggerMixin {
+public:
+  BenchLogger() : LoggerMixin("BenchLogger", LogLevel::kInfo) {}
+  void streamDebug(const int i) const { debug() << "debug message " << i << endmsg; }
+  void streamInfo(const int i) const { info() << "info message " << i << endmsg; }
+  void formatDebug(const int i) const { debug("debug message {}", i); }
+  void formatInfo(const int i) const { info("info message {}", i); }
+  bool debugEnabled() const { return aboveDebugThreshold(); }
+};
+
+class BenchConfigurable : public PropertyMixin {
+private:
+  Property<double> m_threshold{this, "threshold", 1., "Energy threshold"};
+  Property<int> m_layers{this, "layers", 10, "Number of layers"};
+  Property<std::string> m_readout{this, "readout", "EcalHits", "Readout name"};
+  Property<std::vector<double>> m_weights{this, "weights", {1., 2., 3.}, "Weights"};
+};
+
+void benchmarkServiceStartup(Runner& runner) {
+  // register the services, as a framework would do
+  auto& random = RandomSvc::instance();
+  random.setProperty("seed", size_t{1});
+  LogSvc::instance();
+  HistogramSvc::instance();
+  // services are singletons, so their startup can only be measured once per process
+  runner.once("ServiceSvc::init", [] { ServiceSvc::instance().init(); });
+}
+
+void benchmarkAlgorithm(Runner& runner) {
+  SumAlgorithm algo;
+  // call through the algorithm interface, as a framework does
+  const SumAlgorithm::algorithm_type& base = algo;
+  double a = 1., b = 2., sum = 0.;
+  std::vector<double> c{3., 4., 5.};
+
+  runner.run("Algorithm::process (prebuilt tuples)", [&](const size_t n) {
+    const SumAlgorithm::Input input{&a, &b, {&c[0], &c[1], &c[2]}};
+    const SumAlgorithm::Output output{&sum};
+    for (size_t i = 0; i < n; ++i) {
+      base.process(input, output);
+      doNotOptimize(sum);
+    }
+  });
+  runner.run("Algorithm::process (tuples per call)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      base.process({&a, &b, {&c[0], &c[1], &c[2]}}, {&sum});
+      doNotOptimize(sum);
+    }
+  });
+  runner.run("Algorithm::process (optional input missing)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      base.process({&a, nullptr, {}}, {&sum});
+      doNotOptimize(sum);
+    }
+  });
+  // framework entry point, with all instrumentation disabled
+  runner.run("Algorithm::execute (prebuilt tuples)", [&](const size_t n) {
+    const SumAlgorithm::Input input{&a, &b, {&c[0], &c[1], &c[2]}};
+    const SumAlgorithm::Output output{&sum};
+    for (size_t i = 0; i < n; ++i) {
+      doNotOptimize(base.execute(input, output));
+      doNotOptimize(sum);
+    }
+  });
+
+  // rejecting an event by raising versus returning a Status
+  RejectAlgorithm reject;
+  const RejectAlgorithm::algorithm_type& reject_base = reject;
+  runner.run("Algorithm::process (raise)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      try {
+        reject_base.process({&a}, {&sum});
+      } catch (const Error& e) {
+        doNotOptimize(e);
+      }
+    }
+  });
+  runner.run("Algorithm::tryProcess (skip)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      doNotOptimize(reject_base.tryProcess({&a}, {&sum}));
+    }
+  });
+}
+
+void benchmarkTracing(Runner& runner) {
+  SumAlgorithm algo;
+  auto& tracer = Tracer::instance();
+
+  runner.run("Algorithm::traceSpan (disabled)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      const auto span = algo.traceSpan();
+      doNotOptimize(span);
+    }
+  });
+  tracer.enable();
+  runner.run("Algorithm::traceSpan (enabled)", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      const auto span = algo.traceSpan();
+      doNotOptimize(span);
+    }
+  });
+  tracer.enable(false);
+}
+
+void benchmarkLogger(Runner& runner) {
+  // discard reported messages, so only the library overhead is measured
+  LogSvc::instance().init([](LogLevel, std::string_view, std::string_view msg) {
+    doNotOptimize(msg.size());
+  });
+  const BenchLogger logger;
+
+  runner.run("LoggerMixin stream below threshold", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      logger.streamDebug(i);
+    }
+  });
+  runner.run("LoggerMixin format below threshold", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      logger.formatDebug(i);
+    }
+  });
+  runner.run("LoggerMixin guarded below threshold", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      if (logger.debugEnabled()) {
+        logger.streamDebug(i);
+      }
+    }
+  });
+  runner.run("LoggerMixin stream above threshold", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      logger.streamInfo(i);
+    }
+  });
+  runner.run("LoggerMixin format above threshold", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      logger.formatInfo(i);
+    }
+  });
+}
+
+void benchmarkGenerator(Runner& runner, const size_t max_threads) {
+  auto& random = RandomSvc::instance();
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    // one Generator per thread, all sharing the RandomSvc engine
+    runner.run(
+        "Generator::uniform_double",
+        [&](const size_t n) {
+          const auto gen = random.generator();
+          for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(gen.uniform_double());
+          }
+        },
+        nthreads);
+    // a single Generator shared by all threads
+    const auto shared = random.generator();
+    runner.run(
+        "Generator::uniform_double (shared)",
+        [&](const size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(shared.uniform_double());
+          }
+        },
+        nthreads);
+  }
+}
+
+void benchmarkHistograms(Runner& runner, const size_t max_threads) {
+  auto& svc       = HistogramSvc::instance();
+  const auto hist = svc.book("benchmark", "Benchmark histogram", {100, 0., 1.});
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    // each thread fills its own shard
+    runner.run(
+        "HistogramSvc::fill",
+        [&](const size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            svc.fill(hist, (i % 128) / 128.);
+          }
+        },
+        nthreads);
+    // a single histogram shared by all threads, behind a mutex
+    Histogram shared{"shared", "Shared histogram", {100, 0., 1.}};
+    std::mutex mutex;
+    runner.run(
+        "Histogram::fill1D (shared, mutex)",
+        [&](const size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            std::lock_guard<std::mutex> lock{mutex};
+            shared.fill1D((i % 128) / 128.);
+          }
+        },
+        nthreads);
+    doNotOptimize(shared.entries());
+  }
+  doNotOptimize(svc.merge("benchmark").entries());
+}
+
+void benchmarkShardedCache(Runner& runner, const size_t max_threads) {
+  // stand-in for the cellID to position conversion that the cache is meant for
+  constexpr size_t kNKeys = 4096;
+  const auto compute      = [](const uint64_t key) { return 0.5 * key + 1.; };
+  detail::ShardedCache<uint64_t, double> cache;
+  for (uint64_t key = 0; key < kNKeys; ++key) {
+    cache.insert(key, compute(key));
+  }
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    // hits spread over all shards, as for the hits of an event
+    runner.run(
+        "ShardedCache::get (hit)",
+        [&](const size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(cache.get(i % kNKeys, compute));
+          }
+        },
+        nthreads);
+    // all threads hitting the same shard: contention on its reader count
+    runner.run(
+        "ShardedCache::get (hit, single key)",
+        [&](const size_t n) {
+          for (size_t i = 0; i < n; ++i) {
+            doNotOptimize(cache.get(0, compute));
+          }
+        },
+        nthreads);
+  }
+}
+
+void benchmarkProperties(Runner& runner) {
+  BenchConfigurable c;
+  const std::vector<double> weights{0.5, 1.5, 2.5};
+
+  runner.run("Configurable::setProperty<double>", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      c.setProperty("threshold", 1.5);
+    }
+  });
+  runner.run("Configurable::setProperty<vector<double>>", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      c.setProperty("weights", weights);
+    }
+  });
+  runner.run("Configurable::getProperty<double>", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      doNotOptimize(c.getProperty<double>("threshold"));
+    }
+  });
+  runner.run("Configurable::getProperty<string>", [&](const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      doNotOptimize(c.getProperty<std::string>("readout"));
+    }
+  });
+}
+
+template <class T> T parse(std::string_view arg, std::string_view option) {
+  T value{};
+  const auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+  if (ec != std::errc() || end != arg.data() + arg.size()) {
+    throw Error(fmt::format("Invalid value '{}' for {}", arg, option), "algorithms_benchmarks");
+  }
+  return value;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string json;
+  double min_time    = 0.2;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (i + 1 >= argc) {
+        throw Error(fmt::format("Missing value for {}", arg), "algorithms_benchmarks");
+      }
+      if (arg == "--json") {
+        json = argv[++i];
+      } else if (arg == "--min-time") {
+        min_time = parse<double>(argv[++i], arg);
+      } else if (arg == "--threads") {
+        max_threads = parse<size_t>(argv[++i], arg);
+      } else {
+        throw Error(fmt::format("Unknown option {}", arg), "algorithms_benchmarks");
+      }
+    }
+
+    Runner runner{min_time};
+    benchmarkServiceStartup(runner);
+    benchmarkAlgorithm(runner);
+    benchmarkTracing(runner);
+    benchmarkLogger(runner);
+    benchmarkGenerator(runner, max_threads);
+    benchmarkHistograms(runner, max_threads);
+    benchmarkShardedCache(runner, max_threads);
+    benchmarkProperties(runner);
+    if (!json.empty()) {
+      runner.writeJson(json);
+    }
+  } catch (const std::exception& e) {
+    fmt::print(stderr, "{}\n", e.what());
+    fmt::print(stderr,
+               "Usage: {} [--json <file>] [--min-time <seconds>] [--threads <N>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
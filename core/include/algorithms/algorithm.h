@@ -26,8 +26,15 @@
 //
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -37,10 +44,16 @@
 #include <vector>
 
 #include <algorithms/detail/demangle.h>
+#include <algorithms/detail/registry.h>
 #include <algorithms/logger.h>
+#include <algorithms/memory.h>
 #include <algorithms/name.h>
+#include <algorithms/perf.h>
+#include <algorithms/profile.h>
 #include <algorithms/property.h>
 #include <algorithms/service.h>
+#include <algorithms/status.h>
+#include <algorithms/trace.h>
 #include <algorithms/type_traits.h>
 
 namespace algorithms {
@@ -63,7 +76,101 @@ template <class... T> struct Output : std::tuple<output_type_t<T>...> {
 class AlgorithmBase : public PropertyMixin, public LoggerMixin, public NameMixin {
 public:
   AlgorithmBase(std::string_view name, std::string_view description)
-      : LoggerMixin(name), NameMixin(name, description) {}
+      : LoggerMixin(name)
+      , NameMixin(name, description)
+      , m_trace_name{Tracer::instance().intern(name)}
+      , m_perf{PerfCounters::instance().stats(name)} {}
+  // factories hand out instances as std::unique_ptr<AlgorithmBase>
+  virtual ~AlgorithmBase() = default;
+
+  // Attribute the heap allocations of the calling thread to this algorithm for the
+  // lifetime of the returned scope, e.g. around process() in a framework (see MemoryTracker)
+  MemoryScope memoryScope() const {
+    auto& tracker = MemoryTracker::instance();
+    if (!tracker.enabled()) {
+      return MemoryScope{};
+    }
+    // counters are only looked up (under the tracker mutex) once tracking is enabled
+    MemoryStats* stats = m_memory.load(std::memory_order_acquire);
+    if (!stats) {
+      stats = &tracker.stats(name());
+      m_memory.store(stats, std::memory_order_release);
+    }
+    return MemoryScope{*stats};
+  }
+  // Record a span in the execution timeline for the lifetime of the returned object, e.g.
+  // around process() in a framework (see Tracer)
+  TraceSpan traceSpan() const { return TraceSpan{traceCategory(), m_trace_name}; }
+  // Count hardware events of the calling thread for this algorithm for the lifetime of the
+  // returned scope, e.g. around process() in a framework (see PerfCounters)
+  PerfScope perfScope() const { return PerfScope{m_perf}; }
+
+  // Number of problems reported through fail(), skip() and flagWarning() (thread-safe)
+  struct Counters {
+    uint64_t errors   = 0;
+    uint64_t skipped  = 0;
+    uint64_t warnings = 0;
+  };
+  Counters counters() const {
+    return {m_errors.load(std::memory_order_relaxed), m_skipped.load(std::memory_order_relaxed),
+            m_warnings.load(std::memory_order_relaxed)};
+  }
+  void resetCounters() {
+    m_errors   = 0;
+    m_skipped  = 0;
+    m_warnings = 0;
+  }
+  // Only the first maxReports() problems of each kind are logged, the counters keep
+  // counting. Not done through Properties, similar to the log level.
+  void maxReports(const uint64_t n) { m_max_reports = n; }
+  uint64_t maxReports() const { return m_max_reports; }
+
+protected:
+  // Exception-free alternatives to raise() for recoverable per-event conditions, to be
+  // returned from tryProcess(): count the problem, log it (up to maxReports() times), and
+  // return the matching Status
+  Status fail(std::string_view msg) const {
+    if (countReport(m_errors)) {
+      error() << msg << endmsg;
+    }
+    return Status::error(msg);
+  }
+  Status skip(std::string_view reason) const {
+    if (countReport(m_skipped)) {
+      warning() << "Skipping event: " << reason << endmsg;
+    }
+    return Status::skip(reason);
+  }
+  void flagWarning(std::string_view msg) const {
+    if (countReport(m_warnings)) {
+      warning() << msg << endmsg;
+    }
+  }
+
+private:
+  // Increment a counter, returns true if the occurrence should still be logged
+  bool countReport(std::atomic<uint64_t>& counter) const {
+    const auto n = counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (n == m_max_reports + 1) {
+      warning() << "Reached the maximum number of reports, suppressing further messages of "
+                   "this kind"
+                << endmsg;
+    }
+    return n <= m_max_reports;
+  }
+
+  static uint32_t traceCategory() {
+    static const uint32_t category = Tracer::instance().intern("algorithm");
+    return category;
+  }
+
+  mutable std::atomic<MemoryStats*> m_memory{nullptr};
+  const uint32_t m_trace_name;
+  PerfStats& m_perf;
+  mutable std::atomic<uint64_t> m_errors{0};
+  mutable std::atomic<uint64_t> m_skipped{0};
+  mutable std::atomic<uint64_t> m_warnings{0};
+  uint64_t m_max_reports = 10;
 };
 
 // TODO: C++20 Concepts version for better error handling
@@ -85,7 +192,32 @@ public:
 
   virtual ~Algorithm() {}
   virtual void init() {}
+  // Framework entry point to initialize the algorithm: calls init(), recording its time and
+  // allocations in the startup profile (see StartupProfiler). Frameworks should call this
+  // instead of init().
+  void initialize() {
+    InitTimer timer{"algorithm", name()};
+    const auto memory = memoryScope();
+    init();
+  }
   virtual void process(const Input&, const Output&) const {}
+  // Exception-free processing: algorithms that report recoverable per-event conditions
+  // through fail() or skip() override this instead of process(). Defaults to process() for
+  // algorithms that raise.
+  virtual Status tryProcess(const Input& input, const Output& output) const {
+    process(input, output);
+    return {};
+  }
+  // Framework entry point to process an event: calls tryProcess() inside the timeline span,
+  // allocation scope and hardware counter scope of this algorithm (each of which does
+  // nothing unless enabled). Frameworks should call this instead of process() or
+  // tryProcess(), so the instrumentation does not depend on the framework.
+  Status execute(const Input& input, const Output& output) const {
+    const auto span   = traceSpan();
+    const auto memory = memoryScope();
+    const auto perf   = perfScope();
+    return tryProcess(input, output);
+  }
 
   const InputNames& inputNames() const { return m_input_names; }
   const OutputNames& outputNames() const { return m_output_names; }
@@ -95,84 +227,309 @@ private:
   const OutputNames m_output_names;
 };
 
+// Pool of configured and initialized instances of a single algorithm. The first instance
+// (the prototype) is created and configured when the pool is constructed, additional
+// instances are only created when all existing instances are in use. New instances get a
+// copy of the prototype properties and are initialized once, after which they are recycled
+// between users. This allows algorithms with non-thread-safe internal (scratch) state to be
+// used from many threads at the same time, without paying the init() cost more than once
+// per instance.
+//
+// Instances are handed out through acquire() as a handle that automatically returns the
+// instance to the pool when it goes out of scope. The pool needs to outlive all handles.
+template <class AlgoType> class AlgorithmPool {
+public:
+  using factory_type   = std::function<std::unique_ptr<AlgoType>()>;
+  using configure_type = std::function<void(AlgoType&)>;
+
+  class Releaser {
+  public:
+    Releaser(AlgorithmPool* pool = nullptr) : m_pool{pool} {}
+    void operator()(AlgoType* algo) const { m_pool->release(algo); }
+
+  private:
+    AlgorithmPool* m_pool;
+  };
+  using handle_type = std::unique_ptr<AlgoType, Releaser>;
+
+  AlgorithmPool(const factory_type& factory, const configure_type& configure)
+      : m_factory{factory}, m_prototype{m_factory()} {
+    configure(*m_prototype);
+    m_prototype->initialize();
+    m_free.push_back(m_prototype.get());
+  }
+  AlgorithmPool(const AlgorithmPool&) = delete;
+  void operator=(const AlgorithmPool&) = delete;
+
+  // Get an instance for exclusive use by the caller, creating a new one if needed
+  handle_type acquire() {
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      if (!m_free.empty()) {
+        AlgoType* algo = m_free.back();
+        m_free.pop_back();
+        return {algo, Releaser{this}};
+      }
+    }
+    // create and initialize outside of the lock, so other users are not blocked
+    // by a possibly expensive init()
+    AlgoType* algo = create();
+    return {algo, Releaser{this}};
+  }
+  // Ensure at least n instances exist, e.g. one per worker thread before the event loop
+  void reserve(const size_t n) {
+    while (size() < n) {
+      release(create());
+    }
+  }
+
+  const AlgoType& prototype() const { return *m_prototype; }
+  // Total number of instances owned by the pool
+  size_t size() const {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_clones.size() + 1;
+  }
+  // Number of instances currently not in use
+  size_t available() const {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_free.size();
+  }
+
+private:
+  AlgoType* create() {
+    auto algo = m_factory();
+    algo->level(m_prototype->level());
+    algo->copyProperties(*m_prototype);
+    algo->initialize();
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_clones.push_back(std::move(algo));
+    return m_clones.back().get();
+  }
+  void release(AlgoType* algo) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_free.push_back(algo);
+  }
+
+  const factory_type m_factory;
+  const std::unique_ptr<AlgoType> m_prototype;
+  std::vector<std::unique_ptr<AlgoType>> m_clones;
+  std::vector<AlgoType*> m_free;
+  mutable std::mutex m_mutex;
+};
+
 // Algorithm service that stores factories for different algorithms indexed by their
 // underlying algorithm_type. This allows a framework to only need to know about every
 // algorithm_type (algorithm signature) once, which is sufficient to constrain all
 // compile-time code needed.
+//
+// Factories are registered through add() before the service is initialized. At init()
+// the registry is frozen into an immutable table, after which all lookups are lock-free.
+//
+// Algorithms that live in plugin libraries can be listed in one or more manifest files
+// (the "manifests" property) instead of being linked. The library is only loaded with
+// dlopen() when the algorithm is first requested, at which point its static
+// initializers register the factory (see ALGORITHMS_REGISTER_ALGORITHM). Manifest format,
+// one algorithm per line, with empty lines and lines starting with '#' ignored:
+//
+//     <algorithm name>;<demangled algorithm_type>;<shared library>
+//
+// Algorithms can also provide a static property schema, through a static member function
+// `static const PropertySchema& propertySchema()`. This allows the service to list and
+// validate their configuration without creating any instances. As the schema is declared
+// separately from the Property members, it can be checked against a default-constructed
+// instance (names, types, descriptions and defaults) by setting the "checkSchemas"
+// property, e.g. in debug builds or tests: at init() for linked algorithms, and when the
+// plugin library is loaded for the others. A mismatch throws. The check constructs one
+// instance of every algorithm, so it is off by default.
+//
 class AlgorithmSvc : public LoggedService<AlgorithmSvc> {
 public:
+  // Read the plugin manifests and freeze the factory registry, no new factories can be
+  // added after this point
+  void init();
+
   // Add a new factory for an algorithm with a specified type. The full demangled type name
-  // will be used as identifier for the factory
+  // will be used as identifier for the factory.
+  // After initialization this only completes entries from the plugin manifests, other
+  // late registrations are ignored.
   template <class Algo> void add() {
-    static std::mutex m;
-    static std::lock_guard<std::mutex> lock{m};
-    auto type            = Algo::algorithm_type;
-    std::type_index name = detail::demangledName<Algo>();
-    if (!available<type>()) {
-      m_factories[type] = {};
+    using AlgoType         = typename Algo::algorithm_type;
+    const auto& type       = detail::typeName<AlgoType>();
+    const std::string name = detail::demangledName<Algo>();
+    if (!m_factories.frozen()) {
+      // do nothing if already there
+      m_factories.add(type, name, {&make<Algo>, schemaOf<Algo>()});
+      return;
     }
-    if (available<type>(name)) {
-      return; // do nothing, already there
+    // called from a plugin library loaded after init()
+    const auto* entry = m_factories.find(type, name);
+    if (!entry || entry->library.empty()) {
+      warning() << fmt::format("Ignoring registration of algorithm {} after AlgorithmSvc "
+                               "initialization, as it is not listed in any manifest",
+                               name)
+                << endmsg;
+      return;
     }
-    m_factories[type].emplace({name, []() { return static_cast<AlgorithmBase*>(new Algo()); }});
+    entry->schema.store(schemaOf<Algo>(), std::memory_order_relaxed);
+    entry->factory.store(&make<Algo>, std::memory_order_release);
   }
 
   // Get a new owning pointer to an instance of an algorithm.
   // Throws if the resource isn't available, or if we aren't fully ready yet.
   template <class AlgoType> std::unique_ptr<AlgoType> get(std::string_view name) const {
     ensureReady();
-    if (!available<AlgoType>(name)) {
-      raise(fmt::format("No factory with name {} and type {} registered with the AlgorithmSvc",
-                        name, typeid(AlgoType).name()));
-    }
-    const auto& factories = m_factories.at(typeid(AlgoType));
     // This creates and object and gives ownership to the unique_ptr
-    return static_cast<AlgoType*>(factories.at(name)());
+    return std::unique_ptr<AlgoType>{static_cast<AlgoType*>(lookup<AlgoType>(name)().release())};
+  }
+  // Get a pool of configured and initialized instances of an algorithm. The configure
+  // callback is only called once, for the prototype instance, and should set the
+  // properties. All other instances in the pool are copies of the prototype.
+  // Throws if the resource isn't available, or if we aren't fully ready yet.
+  template <class AlgoType>
+  std::unique_ptr<AlgorithmPool<AlgoType>>
+  pool(std::string_view name,
+       const typename AlgorithmPool<AlgoType>::configure_type& configure = [](AlgoType&) {}) const {
+    ensureReady();
+    auto factory = [f = lookup<AlgoType>(name)]() {
+      return std::unique_ptr<AlgoType>{static_cast<AlgoType*>(f().release())};
+    };
+    return std::make_unique<AlgorithmPool<AlgoType>>(factory, configure);
+  }
+  // Get the static property schema of an algorithm, or nullptr if the algorithm does not
+  // provide one. This does not create an instance (but will load its plugin library, which
+  // creates one if the "checkSchemas" property is set).
+  // Throws if the resource isn't available, or if we aren't fully ready yet.
+  template <class AlgoType> const PropertySchema* schema(std::string_view name) const {
+    ensureReady();
+    const auto* entry = find<AlgoType>(name);
+    resolve(*entry, name);
+    const auto schema = entry->schema.load(std::memory_order_relaxed);
+    return schema ? &schema() : nullptr;
+  }
+  // Validate a configuration for an algorithm against its property schema, without
+  // creating an instance. Throws if the configuration is invalid, or if the algorithm
+  // does not provide a schema.
+  template <class AlgoType>
+  void validate(std::string_view name, const PropertySchema::ConfigType& config) const {
+    const auto* s = schema<AlgoType>(name);
+    if (!s) {
+      raise(fmt::format("Algorithm {} does not provide a property schema", name));
+    }
+    try {
+      s->validate(config);
+    } catch (const PropertyError& e) {
+      raise<PropertyError>(fmt::format("Algorithm {}: {}", name, e.what()));
+    }
   }
-  // Return a vector of the names of all available algorithms of a certain type
+  // Write the property schemas of all algorithms that provide one to a compact
+  // tab-separated file. Algorithms from plugin libraries that were not loaded are skipped.
+  void writeSchemas(const std::string& path) const;
+
+  // Return a vector of the names of all available algorithms of a certain type, including
+  // algorithms from plugin libraries that were not loaded yet.
   // Just return an empty vector if no names are present (don't throw any exceptions
   // for missing entries here).
   // Throws if we aren't fully ready yet.
-  template <class AlgoType> auto ls() const {
+  template <class AlgoType> std::vector<std::string_view> ls() const {
     ensureReady();
-    std::vector<std::string_view> ret;
-    if (available<AlgoType>()) {
-      std::for_each(factory<AlgoType>().begin(), factory<AlgoType>().end(), std::back_inserter(ret),
-                    [](auto&& key_value_pair) { return key_value_pair.first(); });
-    }
-    return ret;
+    return m_factories.names(detail::typeName<AlgoType>());
   }
 
 private:
-  // Do we have any algorithms available of a certain type?
-  template <class AlgoType> bool available() const { return !m_factories.count(typeid(AlgoType)); }
-  // Do we have any algorithms of type AlgoType with a specific name available? Throws
-  // if any of the lower-level assumptions fail
-  template <class AlgoType> bool available(std::string_view name) const {
+  // Plain function pointer instead of std::function, as factories never carry state
+  using factory_type = std::unique_ptr<AlgorithmBase> (*)();
+  using schema_type  = const PropertySchema& (*)();
+
+  // Registry entry: either a linked factory, or a factory provided by a plugin library
+  // from one of the manifests (empty until the library is loaded)
+  struct FactoryEntry {
+    FactoryEntry(factory_type f, schema_type s, std::string_view lib = "")
+        : factory{f}, schema{s}, library{lib} {}
+    FactoryEntry(const FactoryEntry& rhs)
+        : factory{rhs.factory.load()}, schema{rhs.schema.load()}, library{rhs.library} {}
+    FactoryEntry& operator=(const FactoryEntry& rhs) {
+      factory.store(rhs.factory.load());
+      schema.store(rhs.schema.load());
+      library = rhs.library;
+      return *this;
+    }
+
+    mutable std::atomic<factory_type> factory;
+    mutable std::atomic<schema_type> schema;
+    std::string library;
+  };
+
+  template <class Algo> static std::unique_ptr<AlgorithmBase> make() {
+    return std::make_unique<Algo>();
+  }
+  template <class Algo> static constexpr schema_type schemaOf() {
+    if constexpr (requires { { Algo::propertySchema() } -> std::same_as<const PropertySchema&>; }) {
+      return &Algo::propertySchema;
+    } else {
+      return nullptr;
+    }
+  }
+
+  // Find the registry entry for an algorithm, throws if not available
+  template <class AlgoType> const FactoryEntry* find(std::string_view name) const {
     if (name == "") {
       raise(fmt::format("Invalid name provided: '{}'", name));
     }
-    return factory<AlgoType>().count(name) != 0;
+    const auto& type  = detail::typeName<AlgoType>();
+    const auto* entry = m_factories.find(type, name);
+    if (!entry) {
+      raise(fmt::format("No factory with name {} and type {} registered with the AlgorithmSvc",
+                        name, type));
+    }
+    return entry;
   }
-  template <class AlgoType> const auto& factory() const {
-    if (!available<AlgoType>()) {
-      raise(fmt::format("No factory for algorithm type {} provided", typeid(AlgoType).name()));
+  // Get the factory for a registry entry, loading its plugin library if needed
+  factory_type resolve(const FactoryEntry& entry, std::string_view name) const {
+    auto factory = entry.factory.load(std::memory_order_acquire);
+    if (!factory) {
+      factory = load(entry, name);
     }
-    return m_factories.at(typeid(AlgoType));
+    return factory;
   }
+  // Find the factory for an algorithm, loading its plugin library if needed.
+  // Throws if not available
+  template <class AlgoType> factory_type lookup(std::string_view name) const {
+    return resolve(*find<AlgoType>(name), name);
+  }
+  // Load the plugin library for a manifest entry, throws if it does not provide the factory
+  factory_type load(const FactoryEntry& entry, std::string_view name) const;
+  // Throw if the static property schema of an algorithm does not match the properties of a
+  // default-constructed instance
+  void checkSchema(std::string_view name, factory_type factory, schema_type schema) const;
+  void readManifest(const std::string& path);
+
   // Throw an exception if we are not ready as factory to avoid giving incomplete factory
   // information to the caller
   void ensureReady() const {
-    if (!ready()) {
+    if (!ready() || !m_factories.frozen()) {
       raise("Attempt to use AlgorithmSvc, but service not yet marked as ready");
     }
   }
 
-  using factory_type = std::function<std::unique_ptr<AlgorithmBase>()>;
+  detail::FrozenRegistry<FactoryEntry> m_factories;
+  mutable std::mutex m_load_mutex;
 
-  std::map<std::type_index, std::map<std::string_view, factory_type>> m_factories;
+  Property<std::vector<std::string>> m_manifests{
+      this, "manifests", {}, "List of manifest files describing lazily loaded plugin algorithms"};
+  Property<bool> m_check_schemas{
+      this, "checkSchemas", false,
+      "Check the property schemas against a default-constructed instance of each algorithm"};
+
+  ALGORITHMS_DEFINE_LOGGED_SERVICE(AlgorithmSvc)
 };
 
+namespace detail {
+  // Helper to register an algorithm with the AlgorithmSvc from a static initializer
+  template <class Algo> struct AlgorithmRegistration {
+    AlgorithmRegistration() { AlgorithmSvc::instance().add<Algo>(); }
+  };
+} // namespace detail
+
 namespace detail {
   template <class T> struct is_input : std::false_type {};
   template <class... T> struct is_input<Input<T...>> : std::true_type {};
@@ -184,3 +541,10 @@ template <class T> constexpr bool is_output_v = detail::is_output<T>::value;
 
 } // namespace algorithms
 
+// Register an algorithm factory with the AlgorithmSvc when the library is loaded
+#define ALGORITHMS_CONCAT_IMPL(a, b) a##b
+#define ALGORITHMS_CONCAT(a, b) ALGORITHMS_CONCAT_IMPL(a, b)
+#define ALGORITHMS_REGISTER_ALGORITHM(className)                                                   \
+  static const ::algorithms::detail::AlgorithmRegistration<className> ALGORITHMS_CONCAT(           \
+      algorithms_registration_, __LINE__){};
+
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Immutable spatial index over the cells of a readout, for "which cells are near this
+// point" and "which cells neighbor this cell" queries. Cell centers are bucketed in a
+// uniform grid sized for a few cells per bucket, and the neighbors of every cell are
+// precomputed once. Safe to share read-only between threads.
+//
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <gsl/gsl>
+#include <optional>
+#include <vector>
+
+#include <DD4hep/Objects.h>
+
+namespace algorithms {
+
+class CellIndex {
+public:
+  // Index the given cells and their (global) positions. Cells whose centers are at most
+  // neighbor_distance apart are neighbors; by default this is 1.5 times the median distance
+  // between a cell and its closest cell, which covers the diagonal neighbors in regular grids.
+  CellIndex(gsl::span<const dd4hep::CellID> cells, gsl::span<const dd4hep::Position> positions,
+            double neighbor_distance = 0.);
+
+  size_t size() const { return m_ids.size(); }
+  bool contains(const dd4hep::CellID id) const { return index(id).has_value(); }
+  std::optional<dd4hep::Position> position(const dd4hep::CellID id) const;
+  double neighborDistance() const { return m_neighbor_distance; }
+
+  // Precomputed neighbors of a cell (empty for unknown cells)
+  gsl::span<const dd4hep::CellID> neighbors(const dd4hep::CellID id) const;
+  // Cells with their center within radius of a point, appended to out (unsorted)
+  void within(const dd4hep::Position& point, const double radius,
+              std::vector<dd4hep::CellID>& out) const;
+  std::vector<dd4hep::CellID> within(const dd4hep::Position& point, const double radius) const {
+    std::vector<dd4hep::CellID> ret;
+    within(point, radius, ret);
+    return ret;
+  }
+  // Cell with the closest center to a point, if any
+  std::optional<dd4hep::CellID> nearest(const dd4hep::Position& point) const;
+
+private:
+  std::optional<size_t> index(const dd4hep::CellID id) const;
+  size_t bin(const std::array<double, 3>& p) const;
+  // Call f(i) for every cell i within radius of p
+  template <class F> void forEachWithin(const std::array<double, 3>& p, double radius, F&& f) const;
+
+  // cells sorted by cellID, positions as separate arrays
+  std::vector<dd4hep::CellID> m_ids;
+  std::array<std::vector<double>, 3> m_pos;
+  // uniform grid: cells of bin b are m_bin_cells[m_bin_offsets[b] ... m_bin_offsets[b+1]]
+  std::array<double, 3> m_min{};
+  std::array<double, 3> m_bin_size{};
+  std::array<size_t, 3> m_nbins{1, 1, 1};
+  std::vector<uint32_t> m_bin_offsets;
+  std::vector<uint32_t> m_bin_cells;
+  // neighbors of cell i are m_neighbor_ids[m_neighbor_offsets[i] ... m_neighbor_offsets[i+1]]
+  double m_neighbor_distance = 0.;
+  std::vector<uint32_t> m_neighbor_offsets;
+  std::vector<dd4hep::CellID> m_neighbor_ids;
+};
+
+} // namespace algorithms
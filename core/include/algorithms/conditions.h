@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Conditions service: calibration constants and other run-dependent payloads, keyed by
+// their interval of validity (IOV, an inclusive range of run numbers), loaded from local
+// files.
+//
+// Payloads are decoded once into immutable ConditionsPayload objects that are shared by
+// all algorithms and threads, and are kept until the end of the job. Lookups from
+// process() are lock-free once the payload for the run is loaded: the last used interval
+// of each condition is checked first, other intervals are found with a binary search in
+// the (immutable) interval table. When a payload is first used, the payload of the next
+// interval is loaded in the background ("prefetch" property), so run transitions do not
+// stall the event loop. Loads are recorded as spans in the execution timeline (see Tracer).
+//
+// Index files ("index" property) list one interval per line, with blank lines and lines
+// starting with '#' (after optional whitespace) ignored. Payload paths are relative to the
+// index file, and '*' as last run means the interval has no upper bound:
+//
+//     <condition name> <first run> <last run> <payload file>
+//
+// Payload files contain one named table of numbers per line, with the same rules for
+// blank lines and comments:
+//
+//     <table name> <value> [<value> ...]
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <algorithms/error.h>
+#include <algorithms/logger.h>
+#include <algorithms/service.h>
+
+namespace algorithms {
+
+class ConditionsError : public Error {
+public:
+  ConditionsError(std::string_view msg) : Error{msg, "algorithms::ConditionsError"} {}
+};
+
+// Decoded payload of a condition for a single interval of validity
+class ConditionsPayload {
+public:
+  using TableMap = std::map<std::string, std::vector<double>, std::less<>>;
+
+  explicit ConditionsPayload(TableMap tables) : m_tables{std::move(tables)} {}
+  // Parse a payload file, throws ConditionsError if the file is invalid
+  static ConditionsPayload read(const std::string& path);
+
+  bool has(std::string_view name) const { return m_tables.count(name); }
+  // Table with the given name, throws ConditionsError if not present
+  const std::vector<double>& table(std::string_view name) const;
+  // Single-valued table, throws ConditionsError if not present or not a single value
+  double value(std::string_view name) const;
+  const TableMap& tables() const { return m_tables; }
+
+private:
+  TableMap m_tables;
+};
+
+// Interval of validity, inclusive on both ends
+struct IOV {
+  static constexpr uint64_t kOpen = UINT64_MAX;
+
+  uint64_t first;
+  uint64_t last = kOpen;
+
+  bool contains(const uint64_t run) const { return run >= first && run <= last; }
+};
+
+// All intervals of a single condition, sorted by run
+class Condition {
+public:
+  explicit Condition(std::string_view name) : m_name{name} {}
+  Condition(const Condition&) = delete;
+  void operator=(const Condition&) = delete;
+
+  const std::string& name() const { return m_name; }
+  // Payload valid for a run, loading it on first use. Lock-free once loaded.
+  // Throws ConditionsError if no interval contains the run, or if the payload is invalid.
+  const ConditionsPayload& at(const uint64_t run) const;
+  // Interval that contains a run, throws ConditionsError if none does
+  const IOV& iov(const uint64_t run) const { return m_intervals[find(run)]->iov; }
+  size_t size() const { return m_intervals.size(); }
+
+private:
+  friend class ConditionsSvc;
+
+  struct Interval {
+    Interval(const IOV& i, std::string_view p) : iov{i}, path{p} {}
+
+    const IOV iov;
+    const std::string path;
+    mutable std::once_flag once;
+    mutable std::unique_ptr<const ConditionsPayload> payload;
+    // set once the payload is loaded, so readers can skip call_once()
+    mutable std::atomic<const ConditionsPayload*> loaded{nullptr};
+  };
+
+  // Index of the interval that contains a run, throws if none does
+  size_t find(const uint64_t run) const;
+  // Payload of an interval, loading it if needed. A failed load is retried on next use.
+  // The first load of a payload prefetches the next interval, unless it is a prefetch.
+  const ConditionsPayload& load(const size_t index, const bool prefetch_next = true) const;
+
+  const std::string m_name;
+  // only modified while the ConditionsSvc is initialized, immutable afterwards
+  std::vector<std::unique_ptr<const Interval>> m_intervals;
+  // last used interval, checked before searching the interval table
+  mutable std::atomic<size_t> m_last{0};
+};
+
+class ConditionsSvc : public LoggedService<ConditionsSvc> {
+public:
+  // Read the index files and check that the intervals of each condition do not overlap.
+  // Payloads are only loaded when first used.
+  void init();
+
+  // Condition with the given name, throws if not available. Keep the reference rather than
+  // calling this for every event.
+  const Condition& condition(std::string_view name) const;
+  // Payload of a condition valid for a run (see Condition::at())
+  const ConditionsPayload& get(std::string_view name, const uint64_t run) const {
+    return condition(name).at(run);
+  }
+  // Load the payloads of all conditions for a run ahead of time, e.g. at a run transition
+  void preload(const uint64_t run) const;
+
+  std::vector<std::string_view> conditions() const;
+
+private:
+  friend class Condition;
+
+  void readIndex(const std::string& path);
+  // Load the payload of an interval in the background, if prefetching is enabled
+  void prefetch(const Condition& condition, const size_t index) const;
+
+  std::map<std::string, std::unique_ptr<Condition>, std::less<>> m_conditions;
+  mutable std::vector<std::future<void>> m_prefetches;
+  mutable std::mutex m_prefetch_mutex;
+
+  Property<std::vector<std::string>> m_index_files{
+      this, "index", {}, "Index files listing the conditions payloads and their validity"};
+  Property<bool> m_prefetch{this, "prefetch", true,
+                            "Load the payloads of the next interval in the background"};
+
+  ALGORITHMS_DEFINE_LOGGED_SERVICE(ConditionsSvc)
+};
+
+} // namespace algorithms
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Compiled configuration snapshot: the properties of many algorithms and services stored
+// in a single binary file. The file is memory-mapped and its structure validated when
+// opened, after which the properties of each owner are decoded and assigned in a single
+// pass.
+//
+// Binary format (native byte order), owners and properties sorted by name:
+//   header:   magic "ALGOCFG\0", uint32 byte-order marker, uint32 version,
+//             uint32 number of owners, uint64 payload size, uint64 payload checksum (FNV-1a)
+//   owner:    string name, uint32 number of properties
+//   property: string name, uint8 type (index in PropertyValue), value
+//   value:    scalars as-is (bool as uint8), strings as uint32 length + bytes,
+//             vectors (also shared ones) as uint32 length + elements
+//
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <algorithms/detail/mapped_file.h>
+#include <algorithms/error.h>
+#include <algorithms/property.h>
+
+namespace algorithms {
+
+class ConfigError : public Error {
+public:
+  ConfigError(std::string_view msg) : Error{msg, "algorithms::ConfigError"} {}
+};
+
+class ConfigSnapshot {
+public:
+  using OwnerConfig = PropertySchema::ConfigType;
+  using ConfigType  = std::map<std::string, OwnerConfig, std::less<>>;
+
+  static constexpr uint32_t kVersion = 1;
+
+  // Write a snapshot file from an in-memory configuration
+  static void write(const std::string& path, const ConfigType& config);
+  // Get all set properties of a Configurable, e.g. to write a snapshot of a live setup
+  static OwnerConfig capture(const Configurable& c);
+
+  // Map and validate a snapshot file (checksum, bounds, type tags, owners and properties
+  // sorted without duplicates), throws ConfigError if the file is invalid
+  explicit ConfigSnapshot(const std::string& path);
+
+  bool has(std::string_view owner) const { return m_owners.count(owner); }
+  std::vector<std::string_view> owners() const;
+  // Set all properties of an owner on a Configurable in a single pass, returns the number
+  // of properties that were set (0 if the owner is not in the snapshot).
+  // Throws if the snapshot contains unknown properties or values of the wrong type.
+  size_t apply(std::string_view owner, Configurable& c) const;
+  // Apply the snapshot to all registered services present in the snapshot
+  void applyServices() const;
+
+private:
+  // Offset of the first property record and number of properties for each owner
+  struct OwnerRecord {
+    size_t offset;
+    uint32_t size;
+  };
+
+  detail::MappedFile m_file;
+  std::map<std::string_view, OwnerRecord, std::less<>> m_owners;
+};
+
+} // namespace algorithms
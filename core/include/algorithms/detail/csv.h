@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Quote a field of a CSV report (RFC 4180), e.g. a demangled algorithm name with commas
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace algorithms::detail {
+
+inline std::string csvField(std::string_view field) {
+  if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+    return std::string{field};
+  }
+  std::string ret{'"'};
+  for (const char c : field) {
+    if (c == '"') {
+      ret += '"';
+    }
+    ret += c;
+  }
+  ret += '"';
+  return ret;
+}
+
+} // namespace algorithms::detail
@@ -28,4 +28,10 @@ template <class T> std::string demangledName() {
   return res.get();
 }
 
+// Cached version of demangledName(), only demangles once per type
+template <class T> const std::string& typeName() {
+  static const std::string name = demangledName<T>();
+  return name;
+}
+
 } // namespace algorithms::detail
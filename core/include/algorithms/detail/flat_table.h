@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Immutable open-addressing hash table, built once from a set of entries. Lookups only
+// read the table (no locks, no atomics), so any number of threads can use it without
+// contention. Meant for tables that are filled at init, e.g. the positions of all cells
+// of a readout.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace algorithms::detail {
+
+// Mixed hash of a key, as std::hash is the identity for integers (e.g. cell IDs) and the
+// low bits often only encode the subsystem
+template <class Key> size_t mixedHash(const Key& key) {
+  size_t h = std::hash<Key>{}(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <class Key, class Value> class FlatTable {
+public:
+  FlatTable() = default;
+  // Build the table, later entries replace earlier entries with the same key
+  explicit FlatTable(const std::vector<std::pair<Key, Value>>& entries) {
+    // at most half full, so probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < 2 * entries.size()) {
+      capacity *= 2;
+    }
+    m_mask = capacity - 1;
+    m_slots.resize(capacity);
+    for (const auto& [key, value] : entries) {
+      auto& slot = m_slots[probe(key)];
+      if (!slot.used) {
+        ++m_size;
+      }
+      slot = {key, value, true};
+    }
+  }
+
+  // Value for a key, nullptr if the key is not in the table
+  const Value* find(const Key& key) const {
+    if (m_slots.empty()) {
+      return nullptr;
+    }
+    const auto& slot = m_slots[probe(key)];
+    return slot.used ? &slot.value : nullptr;
+  }
+  size_t size() const { return m_size; }
+
+  // Call f(key, value) for all entries, e.g. to build a larger table
+  template <class F> void forEach(F&& f) const {
+    for (const auto& slot : m_slots) {
+      if (slot.used) {
+        f(slot.key, slot.value);
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    Key key{};
+    Value value{};
+    bool used = false;
+  };
+
+  // Slot of a key, or the empty slot where it would be inserted (linear probing)
+  size_t probe(const Key& key) const {
+    size_t i = mixedHash(key) & m_mask;
+    while (m_slots[i].used && !(m_slots[i].key == key)) {
+      i = (i + 1) & m_mask;
+    }
+    return i;
+  }
+
+  std::vector<Slot> m_slots;
+  size_t m_mask = 0;
+  size_t m_size = 0;
+};
+
+} // namespace algorithms::detail
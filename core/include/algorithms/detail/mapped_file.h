@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Read-only memory-mapped file, with bounds-checked readers for simple binary formats
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+#include <algorithms/error.h>
+
+namespace algorithms::detail {
+
+// RAII wrapper around a read-only, shared mmap() of a full file. Pages are shared between
+// all processes that map the same file.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path) : m_path{path} {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw algorithms::Error(fmt::format("Failed to open {}", path), "algorithms::MappedFile");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw algorithms::Error(fmt::format("Failed to stat {}", path), "algorithms::MappedFile");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size > 0) {
+      void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw algorithms::Error(fmt::format("Failed to map {}", path), "algorithms::MappedFile");
+      }
+      m_data = static_cast<const std::byte*>(addr);
+    }
+    // the mapping stays valid after closing the file descriptor
+    ::close(fd);
+  }
+  ~MappedFile() {
+    if (m_data) {
+      ::munmap(const_cast<std::byte*>(m_data), m_size);
+    }
+  }
+  MappedFile(const MappedFile&) = delete;
+  void operator=(const MappedFile&) = delete;
+
+  const std::byte* data() const { return m_data; }
+  size_t size() const { return m_size; }
+  const std::string& path() const { return m_path; }
+
+private:
+  const std::string m_path;
+  const std::byte* m_data = nullptr;
+  size_t m_size           = 0;
+};
+
+// Sequential bounds-checked reader over a byte range (e.g. a MappedFile). Values are
+// read with memcpy, so the data does not need to be aligned.
+class ByteReader {
+public:
+  ByteReader(const std::byte* data, const size_t size) : m_data{data}, m_size{size} {}
+
+  template <class T> T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+  std::string_view readString() {
+    const auto len = read<uint32_t>();
+    return {reinterpret_cast<const char*>(take(len)), len};
+  }
+  const std::byte* take(const size_t n) {
+    if (n > m_size - m_pos) {
+      throw algorithms::Error(
+          fmt::format("Unexpected end of data at offset {} (need {} bytes)", m_pos, n),
+          "algorithms::ByteReader");
+    }
+    const auto* ptr = m_data + m_pos;
+    m_pos += n;
+    return ptr;
+  }
+  void seek(const size_t pos) { m_pos = pos; }
+  size_t position() const { return m_pos; }
+  bool done() const { return m_pos == m_size; }
+
+private:
+  const std::byte* m_data;
+  const size_t m_size;
+  size_t m_pos = 0;
+};
+
+// FNV-1a checksum of a byte range, used to validate file payloads. Continues the checksum h
+// of the preceding bytes, to checksum several ranges as one.
+inline uint64_t checksum(const char* data, const size_t size,
+                         uint64_t h = 0xcbf29ce484222325ULL) {
+  for (size_t i = 0; i < size; ++i) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Helpers to write the matching binary data in native byte order
+template <class Stream, class T> void writeBinary(Stream& os, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+template <class Stream> void writeBinaryString(Stream& os, std::string_view str) {
+  writeBinary(os, static_cast<uint32_t>(str.size()));
+  os.write(str.data(), str.size());
+}
+
+} // namespace algorithms::detail
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Two-phase registry of values indexed by (type name, name):
+//   - registration phase: add() is serialized through a mutex
+//   - after freeze(): the registry is an immutable flat table sorted by key hash, so
+//     lookups are a single binary search over integers and need no locking
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fmt/format.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <algorithms/error.h>
+
+namespace algorithms::detail {
+
+template <class Value> class FrozenRegistry {
+public:
+  // Add a new value, returns false if the (type, name) combination was already present.
+  // Throws if the registry is already frozen.
+  bool add(std::string_view type, std::string_view name, const Value& value) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (frozen()) {
+      throw algorithms::Error(
+          fmt::format("Cannot register '{}' after the registry was frozen", name),
+          "algorithms::detail::FrozenRegistry");
+    }
+    return m_staging.emplace(std::make_pair(std::string(type), std::string(name)), value).second;
+  }
+
+  // End the registration phase and build the immutable lookup tables
+  void freeze() {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (frozen()) {
+      return;
+    }
+    m_table.reserve(m_staging.size());
+    for (auto& [key, value] : m_staging) {
+      m_table.push_back({hash(key.first, key.second), key.first, key.second, std::move(value)});
+    }
+    m_staging.clear();
+    std::sort(m_table.begin(), m_table.end(),
+              [](const Entry& a, const Entry& b) { return a.hash < b.hash; });
+    for (const auto& entry : m_table) {
+      m_names[entry.type].push_back(entry.name);
+    }
+    for (auto& [type, names] : m_names) {
+      std::sort(names.begin(), names.end());
+    }
+    m_frozen.store(true, std::memory_order_release);
+  }
+  bool frozen() const { return m_frozen.load(std::memory_order_acquire); }
+
+  // Lock-free lookup, returns nullptr if not present. Throws if not yet frozen.
+  const Value* find(std::string_view type, std::string_view name) const {
+    ensureFrozen();
+    const auto h = hash(type, name);
+    auto it      = std::lower_bound(m_table.begin(), m_table.end(), h,
+                                    [](const Entry& e, const size_t v) { return e.hash < v; });
+    for (; it != m_table.end() && it->hash == h; ++it) {
+      if (it->type == type && it->name == name) {
+        return &it->value;
+      }
+    }
+    return nullptr;
+  }
+  // Sorted names of all entries of a given type (empty if none). Throws if not yet frozen.
+  const std::vector<std::string_view>& names(std::string_view type) const {
+    ensureFrozen();
+    static const std::vector<std::string_view> empty;
+    const auto it = m_names.find(type);
+    return it != m_names.end() ? it->second : empty;
+  }
+  // Call f(type, name, value) for all entries. Throws if not yet frozen.
+  template <class F> void forEach(F&& f) const {
+    ensureFrozen();
+    for (const auto& entry : m_table) {
+      f(std::string_view{entry.type}, std::string_view{entry.name}, entry.value);
+    }
+  }
+  size_t size() const {
+    ensureFrozen();
+    return m_table.size();
+  }
+
+private:
+  struct Entry {
+    size_t hash;
+    std::string type;
+    std::string name;
+    Value value;
+  };
+
+  static size_t hash(std::string_view type, std::string_view name) {
+    size_t h = std::hash<std::string_view>{}(type);
+    h ^= std::hash<std::string_view>{}(name) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
+  }
+  void ensureFrozen() const {
+    if (!frozen()) {
+      throw algorithms::Error("Attempt to look up entries before the registry was frozen",
+                              "algorithms::detail::FrozenRegistry");
+    }
+  }
+
+  // registration phase
+  std::map<std::pair<std::string, std::string>, Value> m_staging;
+  std::mutex m_mutex;
+  // frozen phase
+  std::vector<Entry> m_table;
+  std::map<std::string, std::vector<std::string_view>, std::less<>> m_names;
+  std::atomic<bool> m_frozen{false};
+};
+
+} // namespace algorithms::detail
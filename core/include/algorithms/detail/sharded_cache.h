@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Thread-safe read-mostly cache, filled on first access. Keys are spread over many
+// independently locked shards (each on its own cache line), so writers rarely block
+// readers. Lookups are not free of contention though: every hit takes a shared lock, which
+// writes to the reader count of the shard, and threads that hit the same shard at the same
+// time bounce its cache line between cores. Use a FlatTable for values that are known in
+// advance, and this cache only for the others (see the ShardedCache benchmarks).
+//
+// The cache can be bounded with maxSize(): once a shard is full, values are computed but
+// no longer stored.
+//
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include <algorithms/detail/flat_table.h>
+
+namespace algorithms::detail {
+
+template <class Key, class Value, size_t NShards = 64> class ShardedCache {
+public:
+  // Get the cached value for key, calling compute(key) and storing the result if the key
+  // is not cached yet. compute() is called without holding a lock, and may be called more
+  // than once for the same key if multiple threads miss at the same time.
+  template <class Compute> Value get(const Key& key, Compute&& compute) {
+    auto& shard = m_shards[index(key)];
+    {
+      std::shared_lock<std::shared_mutex> lock{shard.mutex};
+      const auto it = shard.values.find(key);
+      if (it != shard.values.end()) {
+        return it->second;
+      }
+    }
+    Value value = compute(key);
+    std::unique_lock<std::shared_mutex> lock{shard.mutex};
+    if (shard.values.size() < m_shard_size) {
+      shard.values.emplace(key, value);
+    }
+    return value;
+  }
+  // Pre-fill the cache, e.g. for all cells of a readout at init
+  void insert(const Key& key, const Value& value) {
+    auto& shard = m_shards[index(key)];
+    std::unique_lock<std::shared_mutex> lock{shard.mutex};
+    shard.values.insert_or_assign(key, value);
+  }
+  // Limit the number of cached values (approximately, the limit applies per shard)
+  void maxSize(const size_t n) { m_shard_size = (n + NShards - 1) / NShards; }
+  size_t size() const {
+    size_t n = 0;
+    for (const auto& shard : m_shards) {
+      std::shared_lock<std::shared_mutex> lock{shard.mutex};
+      n += shard.values.size();
+    }
+    return n;
+  }
+  void clear() {
+    for (auto& shard : m_shards) {
+      std::unique_lock<std::shared_mutex> lock{shard.mutex};
+      shard.values.clear();
+    }
+  }
+
+private:
+  // shards on separate cache lines to avoid false sharing
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<Key, Value> values;
+  };
+
+  static size_t index(const Key& key) { return mixedHash(key) % NShards; }
+
+  std::array<Shard, NShards> m_shards;
+  size_t m_shard_size = SIZE_MAX;
+};
+
+} // namespace algorithms::detail
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <string>
 #include <type_traits>
+#include <vector>
+
+#include <algorithms/matrix.h>
 
 // Safe type conversions (without narrowing) to be used for properties,
 // gets arround the limitations of type-erasure without explicitly needing
@@ -33,7 +37,31 @@ template <> struct upcast_type<bool> { using type = bool; };
 
 template <class T> using upcast_type_t = typename upcast_type<T>::type;
 
-template <class T> upcast_type_t<T> upcast(T&& value) { return value; }
+// Fixed-size types (std::array and Matrix) are stored with inline storage, but
+// transported as a vector of the upcast element type
+template <class T> struct fixed_size : std::integral_constant<size_t, 0> {};
+template <class T, size_t N>
+struct fixed_size<std::array<T, N>> : std::integral_constant<size_t, N> {};
+template <class T, size_t R, size_t C>
+struct fixed_size<Matrix<T, R, C>> : std::integral_constant<size_t, R * C> {};
+template <class T> constexpr size_t fixed_size_v = fixed_size<T>::value;
+template <class T> constexpr bool is_fixed_size_v = fixed_size_v<T> > 0;
+
+template <class T, size_t N> struct upcast_type<std::array<T, N>> {
+  using type = std::vector<upcast_type_t<T>>;
+};
+template <class T, size_t R, size_t C> struct upcast_type<Matrix<T, R, C>> {
+  using type = std::vector<upcast_type_t<T>>;
+};
+
+template <class T> upcast_type_t<std::decay_t<T>> upcast(T&& value) {
+  using U = std::decay_t<T>;
+  if constexpr (is_fixed_size_v<U>) {
+    return {value.begin(), value.end()};
+  } else {
+    return static_cast<upcast_type_t<U>>(value);
+  }
+}
 
 } // namespace algorithms::detail
 
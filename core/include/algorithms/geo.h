@@ -5,14 +5,47 @@
 // Meant to be set by the calling framework, but can also load DD4hep itself
 // when given a compact file as Property.
 //
+// Also provides thread-safe cellID --> position lookups (cellIDPosition()), as walking the
+// volume manager and segmentation for every hit is expensive, and a batched conversion for
+// many cells at once (cellIDPositions()). Cells prefilled at init (cacheCellIDPositions())
+// are looked up in an immutable hash table without locks; other cells go through a
+// (bounded) cache filled on first access.
+//
+// The cell positions can be exported to a binary GeoSnapshot (writeSnapshot()). When the
+// "snapshot" property is set, a standalone GeoSvc maps the snapshot instead of loading the
+// compact files; only the readouts and cell positions are available in that mode.
+//
+// Subdetectors listed in the "subdetectors" property are only loaded on first access
+// through subdetector() or subdetectorForReadout(), each as its own DD4hep instance. A job
+// that only needs one subsystem can leave "detectors" empty and skip the full geometry; the
+// full-detector accessors (detector(), world(), and the cellID position lookups) then raise,
+// and positions are converted with the converter of the subdetector instead.
+//
+// A CellIndex (spatial index and neighbor table) can be built once per readout, and is
+// then shared read-only by all algorithms through cellIndex().
+//
+// cellIDDecoder() provides a CellIDDecoder for each readout, resolved at init, to decode
+// cellID fields without DD4hep's per-call name lookups.
+//
 #pragma once
 
+#include <atomic>
 #include <gsl/gsl>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "DDRec/CellIDPositionConverter.h"
 #include <DD4hep/Detector.h>
 
+#include <algorithms/cell_index.h>
+#include <algorithms/cellid_decoder.h>
+#include <algorithms/detail/flat_table.h>
+#include <algorithms/detail/sharded_cache.h>
+#include <algorithms/geo_snapshot.h>
 #include <algorithms/logger.h>
 #include <algorithms/service.h>
 
@@ -22,25 +55,150 @@ class GeoSvc : public LoggedService<GeoSvc> {
 public:
   // Initialize the geometry service, to be called after with a global detector
   // pointer (will not re-initialize), or after at least the detectors property was specified
-  // (will load XML and then fully initialize)
+  // (will load XML and then fully initialize), or the snapshot property (will only map the
+  // snapshot)
   void init(const dd4hep::Detector* = nullptr);
 
   // TODO check const-ness
-  gsl::not_null<const dd4hep::Detector*> detector() const { return m_detector; }
+  gsl::not_null<const dd4hep::Detector*> detector() const {
+    if (!m_detector) {
+      raise("No detector available (not initialized, or only a snapshot or subdetectors used)");
+    }
+    return m_detector;
+  }
   dd4hep::DetElement world() const { return detector()->world(); }
+  // True if a full detector is available (not in the snapshot or subdetector-only modes)
+  bool hasDetector() const { return m_detector != nullptr; }
+  // Fingerprint of the full geometry, to tell whether data derived from it is still valid:
+  // the checksum of the compact files it was loaded from (not of files they include), or of
+  // the readouts and their ID specifications for a pre-initialized detector
+  uint64_t fingerprint() const;
   gsl::not_null<const dd4hep::rec::CellIDPositionConverter*> cellIDPositionConverter() const {
+    if (!m_converter) {
+      raise("No cellID converter available (not initialized, or only a snapshot or "
+            "subdetectors used, see subdetector())");
+    }
     return m_converter.get();
   }
+  // Independently loaded part of the geometry
+  struct Subdetector {
+    std::unique_ptr<const dd4hep::Detector> detector;
+    std::unique_ptr<const dd4hep::rec::CellIDPositionConverter> converter;
+  };
+  // Subdetector by name or by one of its readouts, loaded on first access. Thread-safe.
+  const Subdetector& subdetector(std::string_view name) const;
+  const Subdetector& subdetectorForReadout(std::string_view readout) const;
+  // Names of all configured subdetectors (loaded or not)
+  std::vector<std::string_view> subdetectors() const;
+
+  // Mapped geometry snapshot, nullptr unless initialized from a snapshot
+  const GeoSnapshot* snapshot() const { return m_snapshot.get(); }
+
+  // Global position of a cell. Thread-safe. Prefilled cells are found in the immutable
+  // position table (one atomic load and a hash probe, no locks); other cells are cached
+  // after their first lookup (unless disabled through the "cachePositions" property), in a
+  // sharded cache whose hits take a shared lock (see detail::ShardedCache).
+  dd4hep::Position cellIDPosition(const dd4hep::CellID id) const {
+    if (m_snapshot) {
+      return snapshotPosition(id);
+    }
+    if (const auto* table = m_position_table.load(std::memory_order_acquire)) {
+      if (const auto* position = table->find(id)) {
+        return *position;
+      }
+    }
+    const auto converter = cellIDPositionConverter();
+    if (!m_cache_positions) {
+      return converter->position(id);
+    }
+    return m_position_cache.get(
+        id, [converter](const dd4hep::CellID cell) { return converter->position(cell); });
+  }
+  // Add a set of cells (e.g. all cells of a readout) to the immutable position table, so
+  // the event loop never pays for a conversion or a lock. Each call rebuilds the table, so
+  // call this at init, with as many cells at once as possible. Thread-safe.
+  void cacheCellIDPositions(gsl::span<const dd4hep::CellID> ids) const;
+  // Number of cells in the position table and in the cache
+  size_t cachedCellIDPositions() const;
+
+  // Global positions of many cells at once, e.g. all hits of a readout. Cells are grouped
+  // by volume, so the volume lookup and placement transform happen once per group, and the
+  // grid arithmetic of Cartesian segmentations is done in vectorizable loops.
+  // positions must be as large as ids. Bypasses the position cache.
+  void cellIDPositions(gsl::span<const dd4hep::CellID> ids,
+                       gsl::span<dd4hep::Position> positions) const;
+
+  // Decoder of the cellIDs of a readout. Thread-safe, keep the reference (and the fields
+  // taken from it) rather than calling this for every event.
+  const CellIDDecoder& cellIDDecoder(std::string_view readout) const;
+
+  // Build the spatial index and neighbor table of the given cells of a readout (see
+  // CellIndex), typically at init. Indices of readouts listed in the "indexedReadouts"
+  // property are built by init() when using a snapshot, which contains all cells.
+  const CellIndex& buildCellIndex(std::string_view readout, gsl::span<const dd4hep::CellID> cells,
+                                  double neighbor_distance = 0.);
+  // Index of a readout, throws if it was not built. Keep the reference rather than calling
+  // this for every event.
+  const CellIndex& cellIndex(std::string_view readout) const;
+
+  // Export the cell positions of the given readouts (readout name --> cells, e.g. all
+  // cells of the readout) to a binary snapshot, for later use through the "snapshot"
+  // property
+  void writeSnapshot(const std::string& path,
+                     const std::map<std::string, std::vector<dd4hep::CellID>>& readouts) const;
 
 private:
+  struct LazySubdetector {
+    std::string compact;
+    mutable std::once_flag loaded;
+    mutable Subdetector geometry;
+  };
+
+  dd4hep::Position snapshotPosition(const dd4hep::CellID id) const;
+  // cellID field description of a readout
+  std::string idSpec(std::string_view readout) const;
+  std::unique_ptr<const dd4hep::Detector> load(const std::vector<std::string>& files,
+                                               std::string_view name = "") const;
+  void initSubdetectors();
+
+
   const dd4hep::Detector* m_detector = nullptr;
   std::unique_ptr<const dd4hep::Detector> m_detector_ptr;
   std::unique_ptr<const dd4hep::rec::CellIDPositionConverter> m_converter;
+  std::unique_ptr<const GeoSnapshot> m_snapshot;
+  std::map<std::string, LazySubdetector, std::less<>> m_subdetectors;
+  std::map<std::string, std::string, std::less<>> m_readout_subdetectors;
+  std::map<std::string, std::unique_ptr<const CellIndex>, std::less<>> m_cell_indices;
+  mutable std::mutex m_cell_index_mutex;
+  mutable std::map<std::string, std::unique_ptr<const CellIDDecoder>, std::less<>> m_decoders;
+  mutable std::mutex m_decoder_mutex;
+  using PositionTable = detail::FlatTable<dd4hep::CellID, dd4hep::Position>;
+  mutable std::atomic<const PositionTable*> m_position_table{nullptr};
+  // all tables built so far, as readers may still use a replaced table
+  mutable std::vector<std::unique_ptr<const PositionTable>> m_position_tables;
+  mutable std::mutex m_position_table_mutex;
+  mutable detail::ShardedCache<dd4hep::CellID, dd4hep::Position> m_position_cache;
 
   // Configuration variables. These only need to be specified if we are actually running
   // in "standalone" mode (hence they're optional)
   Property<std::vector<std::string>> m_xml_list{
       this, "detectors", {}, "List of DD4hep compact files for standalone operation"};
+  Property<std::string> m_snapshot_path{
+      this, "snapshot", "", "Binary geometry snapshot to use instead of the compact files"};
+  Property<bool> m_verify_snapshot{
+      this, "verifySnapshot", false,
+      "Checksum the full snapshot at init instead of only its index (reads the full file)"};
+  Property<std::vector<std::string>> m_subdetector_list{
+      this, "subdetectors", {}, "Subdetectors loaded on first access, as <name>=<compact file>"};
+  Property<std::vector<std::string>> m_readout_list{
+      this, "subdetectorReadouts", {}, "Readouts of the subdetectors, as <readout>=<name>"};
+  Property<std::vector<std::string>> m_indexed_readouts{
+      this, "indexedReadouts", {}, "Readouts to build a cell index for from the snapshot"};
+  Property<bool> m_cache_positions{this, "cachePositions", true,
+                                   "Cache cellID to position lookups"};
+  Property<uint64_t> m_max_cached_positions{
+      this, "maxCachedPositions", 4000000,
+      "Maximum number of positions cached on first lookup (prefilled cells not included)"};
 
   ALGORITHMS_DEFINE_LOGGED_SERVICE(GeoSvc)
 };
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Binary geometry snapshot: the readouts and cell position tables used by algorithms,
+// exported once from a fully loaded geometry. Later jobs memory-map the snapshot instead
+// of parsing the compact files, and all processes on a node share the same pages.
+//
+// Binary format (native byte order), readouts sorted by name:
+//   header:  magic "ALGOGEO\0", uint32 byte-order marker, uint32 version,
+//            uint32 number of readouts, uint64 payload size, uint64 index checksum,
+//            uint64 payload checksum (both FNV-1a)
+//   readout: string name, string cellID field description, uint64 number of cells,
+//            uint32 number of systems, uint64 system bits of the cells (sorted, none
+//            without a "system" field), zero padding up to the next 8-byte aligned offset,
+//            cellIDs (uint64, sorted), then the global x, y and z positions (double) of
+//            all cells as separate arrays
+//   string:  uint32 length + bytes
+//
+// The index checksum covers the readout headers (everything but the padding and the
+// tables), so opening a snapshot only reads the pages it needs. The payload checksum over
+// the full file is only verified on request.
+//
+#pragma once
+
+#include <gsl/gsl>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <DD4hep/Objects.h>
+
+#include <algorithms/detail/mapped_file.h>
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+class GeoSnapshotError : public Error {
+public:
+  GeoSnapshotError(std::string_view msg) : Error{msg, "algorithms::GeoSnapshotError"} {}
+};
+
+class GeoSnapshot {
+public:
+  static constexpr uint32_t kVersion = 2;
+
+  // Input for write()
+  struct ReadoutData {
+    std::string name;
+    std::string id_spec; // cellID field description, e.g. "system:8,layer:4,x:32:-16,y:-16"
+    std::vector<std::pair<dd4hep::CellID, dd4hep::Position>> cells;
+  };
+  // View on one readout of a mapped snapshot
+  struct Readout {
+    std::string_view name;
+    std::string_view id_spec;
+    gsl::span<const dd4hep::CellID> cells; // sorted
+    gsl::span<const double> x;
+    gsl::span<const double> y;
+    gsl::span<const double> z;
+
+    std::optional<dd4hep::Position> position(const dd4hep::CellID id) const;
+  };
+
+  // Write a snapshot file. Duplicate cells of a readout are only stored once.
+  static void write(const std::string& path, std::vector<ReadoutData> readouts);
+
+  // Map and validate a snapshot file, throws GeoSnapshotError if the file is invalid. The
+  // cell tables are only checksummed with verify, as that reads the full file.
+  explicit GeoSnapshot(const std::string& path, const bool verify = false);
+
+  const std::string& path() const { return m_file.path(); }
+  const std::vector<Readout>& readouts() const { return m_readouts; }
+  // nullptr if the readout is not in the snapshot
+  const Readout* readout(std::string_view name) const;
+  // Global position of a cell from any readout, if present in the snapshot. Only searches
+  // the readouts with cells in the system of the cell.
+  std::optional<dd4hep::Position> position(const dd4hep::CellID id) const;
+
+private:
+  struct SystemEntry {
+    uint64_t mask;
+    uint64_t bits;
+    uint32_t readout;
+    bool operator<(const SystemEntry& rhs) const {
+      return std::tie(mask, bits, readout) < std::tie(rhs.mask, rhs.bits, rhs.readout);
+    }
+  };
+
+  detail::MappedFile m_file;
+  std::vector<Readout> m_readouts;
+  // readouts by the system bits of their cells (sorted), the distinct system field masks,
+  // and the readouts without a system field
+  std::vector<SystemEntry> m_systems;
+  std::vector<uint64_t> m_system_masks;
+  std::vector<uint32_t> m_unindexed;
+};
+
+} // namespace algorithms
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Histogram service for in-process monitoring: 1D and 2D histograms with fixed binning,
+// filled from process() on any thread without locks or atomics.
+//
+// Histograms are booked once (e.g. in init()), and filled through the returned handle:
+//
+//   m_energy = HistogramSvc::instance().book("ecal_energy", "Cluster energy [GeV]",
+//                                            {100, 0., 10.});
+//   ...
+//   HistogramSvc::instance().fill(m_energy, cluster.energy);
+//
+// Each thread fills its own copy (shard) of a histogram, allocated on its first fill, so
+// threads never write to shared memory. Shards are only combined when the merged
+// histograms are requested with merge() or write(). Merging reads the shards of all
+// threads, so it must not run concurrently with fills: call it between events or at the
+// end of the job. Shards are kept when their thread exits.
+//
+// Merged histograms are written to a text file ("output" property), with one block per
+// histogram. Bin contents include the underflow and overflow bins, in x-major order
+// (bin (ix, iy) is at ix + (nx + 2) * iy):
+//
+//     histogram <name> <dimension> <entries>
+//     title <title>
+//     axis <nbins> <min> <max>           (once per dimension)
+//     sumw <value> [<value> ...]
+//     sumw2 <value> [<value> ...]
+//
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <algorithms/error.h>
+#include <algorithms/logger.h>
+#include <algorithms/service.h>
+
+namespace algorithms {
+
+class HistogramError : public Error {
+public:
+  HistogramError(std::string_view msg) : Error{msg, "algorithms::HistogramError"} {}
+};
+
+// Fixed binning of a histogram axis, with an underflow (0) and overflow (nbins + 1) bin
+class Axis {
+public:
+  // Throws HistogramError if there are no bins or if the range is empty
+  Axis(const size_t nbins, const double min, const double max);
+
+  size_t nbins() const { return m_nbins; }
+  double min() const { return m_min; }
+  double max() const { return m_max; }
+  double width() const { return (m_max - m_min) / m_nbins; }
+
+  // Bin that contains a value, NaN goes to the underflow bin
+  size_t index(const double x) const {
+    if (!(x >= m_min)) {
+      return 0;
+    }
+    if (x >= m_max) {
+      return m_nbins + 1;
+    }
+    // guard against rounding up to nbins just below the upper edge
+    const auto i = static_cast<size_t>((x - m_min) * m_scale);
+    return 1 + (i < m_nbins ? i : m_nbins - 1);
+  }
+
+  bool operator==(const Axis& other) const {
+    return m_nbins == other.m_nbins && m_min == other.m_min && m_max == other.m_max;
+  }
+
+private:
+  size_t m_nbins;
+  double m_min;
+  double m_max;
+  double m_scale; // bins per unit
+};
+
+// Histogram with 1 or 2 axes, holding the sum of weights and of squared weights per bin.
+// Filling is not thread-safe, use the HistogramSvc to fill from multiple threads.
+class Histogram {
+public:
+  Histogram(std::string_view name, std::string_view title, const Axis& x);
+  Histogram(std::string_view name, std::string_view title, const Axis& x, const Axis& y);
+
+  // Fill a 1D or 2D histogram, the dimension is not checked
+  void fill1D(const double x, const double w = 1.) { add(m_axes[0].index(x), w); }
+  void fill2D(const double x, const double y, const double w = 1.) {
+    add(m_axes[0].index(x) + (m_axes[0].nbins() + 2) * m_axes[1].index(y), w);
+  }
+  // Add the contents of another histogram, throws HistogramError if the binning differs
+  void add(const Histogram& other);
+  // Clear all bins, keeping the binning
+  void reset();
+
+  const std::string& name() const { return m_name; }
+  const std::string& title() const { return m_title; }
+  size_t dimension() const { return m_axes.size(); }
+  const Axis& axis(const size_t i) const { return m_axes.at(i); }
+  bool sameBinning(const Histogram& other) const { return m_axes == other.m_axes; }
+
+  uint64_t entries() const { return m_entries; }
+  // Bin content and statistical uncertainty, including the underflow and overflow bins
+  double content(const size_t ix, const size_t iy = 0) const { return m_sumw[bin(ix, iy)]; }
+  double error(const size_t ix, const size_t iy = 0) const;
+  // Sum of weights of all bins within range (no underflow or overflow)
+  double integral() const;
+  const std::vector<double>& sumw() const { return m_sumw; }
+  const std::vector<double>& sumw2() const { return m_sumw2; }
+
+  // Write histograms to a text file (see the format above), throws HistogramError
+  static void write(const std::string& path, const std::vector<Histogram>& histograms);
+  // Read histograms from a file written by write(), throws HistogramError if it is invalid
+  static std::vector<Histogram> read(const std::string& path);
+
+private:
+  void add(const size_t index, const double w) {
+    ++m_entries;
+    m_sumw[index] += w;
+    m_sumw2[index] += w * w;
+  }
+  size_t bin(const size_t ix, const size_t iy) const;
+
+  std::string m_name;
+  std::string m_title;
+  std::vector<Axis> m_axes;
+  uint64_t m_entries = 0;
+  std::vector<double> m_sumw;
+  std::vector<double> m_sumw2;
+};
+
+namespace detail {
+  // Histograms filled by a thread, indexed by their HistogramSvc id (null if not filled)
+  using HistogramShard = std::vector<std::unique_ptr<Histogram>>;
+  extern thread_local HistogramShard* t_histogram_shard;
+} // namespace detail
+
+class HistogramSvc : public LoggedService<HistogramSvc> {
+public:
+  // Typed handles, so a 1D histogram cannot be filled with 2D values
+  struct Handle1D {
+    uint32_t id = UINT32_MAX;
+  };
+  struct Handle2D {
+    uint32_t id = UINT32_MAX;
+  };
+
+  void init();
+
+  // Book a histogram. Booking an existing name again (e.g. from several instances of an
+  // algorithm) returns the same histogram, and throws HistogramError if the binning
+  // differs. Names cannot contain whitespace.
+  Handle1D book(std::string_view name, std::string_view title, const Axis& x);
+  Handle2D book(std::string_view name, std::string_view title, const Axis& x, const Axis& y);
+
+  // Fill the shard of the calling thread, no locking once the thread filled the histogram
+  void fill(const Handle1D h, const double x, const double w = 1.) const {
+    local(h.id).fill1D(x, w);
+  }
+  void fill(const Handle2D h, const double x, const double y, const double w = 1.) const {
+    local(h.id).fill2D(x, y, w);
+  }
+
+  // Merged histograms over all threads. Must not be called concurrently with fills.
+  Histogram merge(std::string_view name) const;
+  std::vector<Histogram> merge() const;
+  // Write the merged histograms to the "output" file, or to another path, e.g. at the end
+  // of the job. Must not be called concurrently with fills.
+  void write() const { write(m_output.value()); }
+  void write(const std::string& path) const;
+  // Clear the shards of all threads, e.g. after writing the histograms of a run. Must not
+  // be called concurrently with fills.
+  void reset();
+
+  std::vector<std::string_view> histograms() const;
+  // Number of threads that filled a histogram
+  size_t shards() const;
+
+private:
+  Histogram& local(const uint32_t id) const {
+    auto* shard = detail::t_histogram_shard;
+    if (shard && id < shard->size() && (*shard)[id]) {
+      return *(*shard)[id];
+    }
+    return createLocal(id);
+  }
+  // Slow path of local(): register the shard of the thread and copy the booked histogram
+  Histogram& createLocal(const uint32_t id) const;
+  uint32_t book(Histogram&& histogram);
+
+  // empty histograms as booked, indexed by id
+  std::vector<Histogram> m_booked;
+  std::map<std::string, uint32_t, std::less<>> m_ids;
+  mutable std::vector<std::unique_ptr<detail::HistogramShard>> m_shards;
+  mutable std::mutex m_mutex;
+
+  Property<std::string> m_output{this, "output", "histograms.txt",
+                                 "File the merged histograms are written to by write()"};
+
+  ALGORITHMS_DEFINE_LOGGED_SERVICE(HistogramSvc)
+};
+
+} // namespace algorithms
@@ -259,6 +259,10 @@ private:
 
 // A Service base class with logger functionality
 template <class SvcType> class LoggedService : public Service<SvcType>, public LoggerMixin {
+public:
+  // initialize the LogSvc (and the log action of the framework) before any logging service
+  static constexpr std::array<std::string_view, 1> kImplicitDependencies{"LogSvc"};
+
 protected:
   LoggedService(std::string_view name) : Service<SvcType>(name), LoggerMixin(name) {}
 };
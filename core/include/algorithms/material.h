@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Material and magnetic field of the geometry sampled on a regular 3D grid, for fast
+// (trilinear interpolated) lookups in fast simulation and track fitting, where querying
+// the full DD4hep geometry for every step is far too slow.
+//
+// The MaterialSvc builds the grid from the full geometry loaded by the GeoSvc (not from a
+// snapshot or subdetectors only), and can cache it in a binary file that later jobs
+// memory-map instead of sampling the geometry again. The material of each node is the
+// path-length weighted average over its voxel, so thin layers are not missed.
+//
+// Binary format (native byte order):
+//   header: magic "ALGOVOX\0", uint32 byte-order marker, uint32 version,
+//           double min[3], double max[3], uint32 nodes[3], uint32 number of channels,
+//           uint32 subsamples, uint32 field sampled (0 or 1), uint64 geometry fingerprint,
+//           uint64 payload size, uint64 payload checksum (FNV-1a)
+//   data:   float values, channels fastest, then x, y, z
+//
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <gsl/gsl>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <DD4hep/Objects.h>
+
+#include <algorithms/detail/mapped_file.h>
+#include <algorithms/error.h>
+#include <algorithms/logger.h>
+#include <algorithms/service.h>
+
+namespace algorithms {
+
+class MaterialGridError : public Error {
+public:
+  MaterialGridError(std::string_view msg) : Error{msg, "algorithms::MaterialGridError"} {}
+};
+
+class MaterialGrid {
+public:
+  static constexpr uint32_t kVersion = 2;
+
+  // Sampled quantities, in DD4hep units
+  enum Channel : size_t {
+    kInvRadLength, // 1 / radiation length
+    kInvIntLength, // 1 / nuclear interaction length
+    kDensity,
+    kBx,
+    kBy,
+    kBz,
+    kNChannels
+  };
+  using Values = std::array<float, kNChannels>;
+
+  // Grid nodes span [min, max] on each axis, with at least 2 nodes per axis. The grid also
+  // records how it was sampled, so a cached grid is only reused for the same settings and
+  // geometry.
+  struct Spec {
+    std::array<double, 3> min;
+    std::array<double, 3> max;
+    std::array<uint32_t, 3> nodes;
+    uint32_t subsamples = 1;
+    bool sample_field   = true;
+    uint64_t geometry   = 0; // GeoSvc::fingerprint() of the sampled geometry
+
+    size_t size() const { return size_t(nodes[0]) * nodes[1] * nodes[2]; }
+    bool operator==(const Spec&) const = default;
+  };
+
+  // Empty (all zero) grid, to be filled with set()
+  explicit MaterialGrid(const Spec& spec);
+  // Map and validate a grid file, throws MaterialGridError if the file is invalid
+  static std::unique_ptr<const MaterialGrid> open(const std::string& path);
+
+  void write(const std::string& path) const;
+
+  const Spec& spec() const { return m_spec; }
+  dd4hep::Position node(const uint32_t ix, const uint32_t iy, const uint32_t iz) const;
+  void set(const uint32_t ix, const uint32_t iy, const uint32_t iz, const Values& values);
+
+  bool inside(const dd4hep::Position& pos) const;
+  // Trilinear interpolation of all channels, zero outside of the grid
+  Values at(const dd4hep::Position& pos) const;
+  double radiationLength(const dd4hep::Position& pos) const {
+    return 1. / at(pos)[kInvRadLength];
+  }
+  dd4hep::Direction field(const dd4hep::Position& pos) const {
+    const auto v = at(pos);
+    return {v[kBx], v[kBy], v[kBz]};
+  }
+  // Material budget of the straight path between two points, in radiation lengths
+  // (or in interaction lengths for kInvIntLength)
+  double materialBudget(const dd4hep::Position& from, const dd4hep::Position& to,
+                        const Channel channel = kInvRadLength) const;
+
+private:
+  MaterialGrid(const Spec& spec, std::unique_ptr<detail::MappedFile> file,
+               gsl::span<const float> values);
+
+  size_t offset(const uint32_t ix, const uint32_t iy, const uint32_t iz) const {
+    return ((size_t(iz) * m_spec.nodes[1] + iy) * m_spec.nodes[0] + ix) * kNChannels;
+  }
+
+  Spec m_spec;
+  std::array<double, 3> m_spacing;
+  // values are either owned (built in memory) or mapped from a file
+  std::vector<float> m_owned;
+  std::unique_ptr<detail::MappedFile> m_file;
+  gsl::span<const float> m_values;
+};
+
+// Service that builds (or loads) the material grid for the geometry of the GeoSvc
+class MaterialSvc : public LoggedService<MaterialSvc> {
+public:
+  static constexpr std::array<std::string_view, 1> kDependencies{"GeoSvc"};
+
+  // Load the grid from the cache file if it matches the configured grid, sampling settings
+  // and geometry, otherwise sample the geometry (and write the cache file if configured).
+  // Without a full geometry (e.g. a GeoSvc snapshot) the geometry cannot be checked.
+  void init();
+
+  const MaterialGrid& grid() const {
+    if (!m_grid) {
+      raise("Material grid not available, MaterialSvc was not initialized");
+    }
+    return *m_grid;
+  }
+  MaterialGrid::Values at(const dd4hep::Position& pos) const { return grid().at(pos); }
+  double materialBudget(const dd4hep::Position& from, const dd4hep::Position& to) const {
+    return grid().materialBudget(from, to);
+  }
+
+private:
+  std::unique_ptr<const MaterialGrid> build(const MaterialGrid::Spec& spec) const;
+
+  std::unique_ptr<const MaterialGrid> m_grid;
+
+  Property<std::vector<double>> m_min{
+      this, "gridMin", {-300., -300., -500.}, "Lower corner of the grid (DD4hep units)"};
+  Property<std::vector<double>> m_max{
+      this, "gridMax", {300., 300., 500.}, "Upper corner of the grid (DD4hep units)"};
+  Property<std::vector<uint32_t>> m_nodes{
+      this, "gridNodes", {121, 121, 201}, "Number of grid nodes along x, y and z"};
+  Property<uint32_t> m_subsamples{
+      this, "subsamples", 2,
+      "Lines per voxel and axis (squared) used to average the material of each voxel"};
+  Property<bool> m_sample_field{this, "sampleField", true, "Sample the magnetic field"};
+  Property<std::string> m_cache_file{
+      this, "cacheFile", "", "Grid file to load, or to write after sampling the geometry"};
+
+  ALGORITHMS_DEFINE_LOGGED_SERVICE(MaterialSvc)
+};
+
+} // namespace algorithms
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Minimal fixed-size matrix with inline (row-major) storage, meant for small matrices
+// used as Property, e.g. Property<Matrix<double, 3, 3>>.
+//
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+namespace algorithms {
+
+template <class T, size_t R, size_t C> struct Matrix {
+  using value_type              = T;
+  static constexpr size_t kRows = R;
+  static constexpr size_t kCols = C;
+  static constexpr size_t kSize = R * C;
+
+  std::array<T, kSize> data{};
+
+  constexpr T& operator()(const size_t row, const size_t col) { return data[row * C + col]; }
+  constexpr const T& operator()(const size_t row, const size_t col) const {
+    return data[row * C + col];
+  }
+  static constexpr size_t rows() { return R; }
+  static constexpr size_t cols() { return C; }
+  static constexpr size_t size() { return kSize; }
+
+  constexpr auto begin() { return data.begin(); }
+  constexpr auto end() { return data.end(); }
+  constexpr auto begin() const { return data.begin(); }
+  constexpr auto end() const { return data.end(); }
+
+  constexpr bool operator==(const Matrix&) const = default;
+};
+
+} // namespace algorithms
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Heap allocation accounting: attributes allocations made through operator new to the
+// algorithm or service that is running on the allocating thread, and reports allocation
+// counts, bytes and high-water marks (peak live bytes) per name.
+//
+// Algorithm::execute() attributes the allocations of each event to the algorithm. Use the
+// RAII MemoryScope to attribute the allocations of other steps, scopes can be nested:
+//
+//   {
+//     auto scope = algo.memoryScope();
+//     algo.prepare();
+//   }
+//
+// Memory is attributed to the scope that allocated it, also when it is freed elsewhere
+// (e.g. an output collection deleted by the framework). Accounting requires the allocation
+// hooks, which replace the global operator new/delete: build with
+// ALGORITHMS_TRACK_ALLOCATIONS and link the algorithms::memhooks object library into the
+// executable (never into a shared library or plugin). Accounting is then enabled at runtime
+// with MemoryTracker::instance().enable(). Allocations of other threads, or outside of any
+// scope, are not accounted.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fmt/format.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <algorithms/detail/csv.h>
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+// Allocation counters for a single name, updated concurrently by all threads
+class MemoryStats {
+public:
+  explicit MemoryStats(std::string_view name) : m_name{name} {}
+  MemoryStats(const MemoryStats&) = delete;
+  void operator=(const MemoryStats&) = delete;
+
+  void allocated(const uint64_t bytes) {
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    const int64_t live = m_live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak       = m_peak.load(std::memory_order_relaxed);
+    while (live > peak && !m_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+  }
+  void deallocated(const uint64_t bytes) {
+    m_deallocations.fetch_add(1, std::memory_order_relaxed);
+    m_live.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  const std::string& name() const { return m_name; }
+  uint64_t allocations() const { return m_allocations.load(std::memory_order_relaxed); }
+  uint64_t deallocations() const { return m_deallocations.load(std::memory_order_relaxed); }
+  uint64_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+  // Bytes allocated in this scope that are not freed yet, and their maximum
+  int64_t live() const { return m_live.load(std::memory_order_relaxed); }
+  int64_t peak() const { return m_peak.load(std::memory_order_relaxed); }
+
+private:
+  const std::string m_name;
+  std::atomic<uint64_t> m_allocations{0};
+  std::atomic<uint64_t> m_deallocations{0};
+  std::atomic<uint64_t> m_bytes{0};
+  std::atomic<int64_t> m_live{0};
+  std::atomic<int64_t> m_peak{0};
+};
+
+namespace detail {
+  // Scope of the running thread, read by the allocation hooks
+  extern thread_local MemoryStats* t_memory_scope;
+  // Called by the allocation hooks at startup, so MemoryTracker::hooked() reports them
+  void registerAllocationHooks();
+} // namespace detail
+
+class MemoryTracker {
+public:
+  struct Record {
+    std::string name;
+    uint64_t allocations;
+    uint64_t deallocations;
+    uint64_t bytes; // total allocated
+    int64_t live;   // still allocated
+    int64_t peak;   // high-water mark of the live bytes
+  };
+
+  static MemoryTracker& instance() {
+    // Never destroyed, as allocations that are freed during static destruction still
+    // refer to their MemoryStats
+    static MemoryTracker* tracker = new MemoryTracker;
+    return *tracker;
+  }
+
+  // True if the allocation hooks are linked into the executable
+  static bool hooked();
+
+  void enable(const bool value = true) { m_enabled.store(value, std::memory_order_relaxed); }
+  bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  // Counters for a name, created on first use. The reference stays valid until the end of
+  // the job, so hot code should look it up once.
+  MemoryStats& stats(std::string_view name) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto it = m_stats.find(name);
+    if (it == m_stats.end()) {
+      it = m_stats.emplace(name, std::make_unique<MemoryStats>(name)).first;
+    }
+    return *it->second;
+  }
+
+  // All names with at least one allocation, sorted by decreasing high-water mark
+  std::vector<Record> records() const {
+    std::vector<Record> ret;
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      for (const auto& [name, s] : m_stats) {
+        if (s->allocations() > 0) {
+          ret.push_back(
+              {name, s->allocations(), s->deallocations(), s->bytes(), s->live(), s->peak()});
+        }
+      }
+    }
+    std::stable_sort(ret.begin(), ret.end(),
+                     [](const Record& a, const Record& b) { return a.peak > b.peak; });
+    return ret;
+  }
+
+  // Human-readable report, sorted by decreasing high-water mark
+  std::string report() const {
+    if (!hooked()) {
+      return "Allocation tracking not available, the algorithms::memhooks allocation hooks "
+             "are not linked into the executable\n";
+    }
+    std::string ret = fmt::format("{:<40} {:>12} {:>12} {:>14} {:>12} {:>12}\n", "name",
+                                  "allocations", "frees", "allocated [kB]", "live [kB]",
+                                  "peak [kB]");
+    for (const auto& r : records()) {
+      ret += fmt::format("{:<40} {:>12} {:>12} {:>14.1f} {:>12.1f} {:>12.1f}\n", r.name,
+                         r.allocations, r.deallocations, r.bytes / 1024., r.live / 1024.,
+                         r.peak / 1024.);
+    }
+    return ret;
+  }
+  // Machine-readable CSV report, sorted by decreasing high-water mark
+  void write(const std::string& path) const {
+    std::ofstream out{path};
+    if (!out) {
+      throw Error(fmt::format("Failed to open {} to write the allocation report", path),
+                  "algorithms::MemoryTracker");
+    }
+    out << "name,allocations,deallocations,bytes,live_bytes,peak_bytes\n";
+    for (const auto& r : records()) {
+      out << fmt::format("{},{},{},{},{},{}\n", detail::csvField(r.name), r.allocations,
+                         r.deallocations, r.bytes, r.live, r.peak);
+    }
+  }
+
+private:
+  MemoryTracker() = default;
+
+  std::atomic<bool> m_enabled{false};
+  std::map<std::string, std::unique_ptr<MemoryStats>, std::less<>> m_stats;
+  mutable std::mutex m_mutex;
+
+public:
+  MemoryTracker(const MemoryTracker&) = delete;
+  void operator=(const MemoryTracker&) = delete;
+};
+
+// Attributes the allocations of the current thread to a name during its lifetime, and
+// restores the enclosing scope afterwards. Does nothing if tracking is not enabled.
+class MemoryScope {
+public:
+  // Scope that does not change the attribution
+  MemoryScope() : m_previous{detail::t_memory_scope} {}
+  explicit MemoryScope(MemoryStats& stats) : m_previous{detail::t_memory_scope} {
+    if (MemoryTracker::instance().enabled()) {
+      detail::t_memory_scope = &stats;
+    }
+  }
+  // Only looks up the counters of the name if tracking is enabled
+  explicit MemoryScope(std::string_view name) : m_previous{detail::t_memory_scope} {
+    auto& tracker = MemoryTracker::instance();
+    if (tracker.enabled()) {
+      detail::t_memory_scope = &tracker.stats(name);
+    }
+  }
+  ~MemoryScope() { detail::t_memory_scope = m_previous; }
+  MemoryScope(const MemoryScope&) = delete;
+  void operator=(const MemoryScope&) = delete;
+
+private:
+  MemoryStats* const m_previous;
+};
+
+} // namespace algorithms
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Hardware performance counters per algorithm: cycles, instructions, cache references and
+// misses, and branches and branch misses of the calling thread are read with Linux
+// perf_event_open() around each scope, and aggregated per name into a report with IPC
+// and miss rates, to tell whether an algorithm is memory-bound, mispredicting branches or
+// thrashing the caches.
+//
+// Algorithm::execute() counts each event for the algorithm. Use the RAII PerfScope to count
+// other steps:
+//
+//   {
+//     auto scope = algo.perfScope();
+//     algo.prepare();
+//   }
+//
+// Counting is off by default, and enabled with PerfCounters::instance().enable(). Each
+// thread opens its own counter group on first use. Counts of nested scopes are included
+// in the enclosing scope, and only user-space events are counted (which also works with
+// the default perf_event_paranoid level of 2). Counters that the CPU (or virtual machine)
+// does not provide are reported as unavailable; if the cycle counter cannot be opened,
+// scopes do nothing and the report gives the reason. When the PMU is shared (multiplexed),
+// the counts of a scope are scaled by the fraction of its time the counters were running;
+// scopes during which they did not run at all are counted as unscheduled.
+//
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace algorithms {
+
+// Aggregated counts for a single name, updated concurrently by all threads
+class PerfStats {
+public:
+  enum Counter : size_t {
+    kCycles,
+    kInstructions,
+    kCacheReferences,
+    kCacheMisses,
+    kBranches,
+    kBranchMisses,
+    kNCounters
+  };
+  using Values = std::array<uint64_t, kNCounters>;
+  // Raw cumulative counts, and the times the counter group was enabled and running
+  struct Sample {
+    Values values;
+    uint64_t enabled;
+    uint64_t running;
+  };
+
+  explicit PerfStats(std::string_view name) : m_name{name} {}
+  PerfStats(const PerfStats&) = delete;
+  void operator=(const PerfStats&) = delete;
+
+  void add(const Values& values) {
+    m_calls.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < kNCounters; ++i) {
+      m_values[i].fetch_add(values[i], std::memory_order_relaxed);
+    }
+  }
+
+  // Scope during which the counters were never scheduled on the PMU
+  void unscheduled() { m_unscheduled.fetch_add(1, std::memory_order_relaxed); }
+
+  const std::string& name() const { return m_name; }
+  // Number of counted scopes, and of scopes that could not be counted
+  uint64_t calls() const { return m_calls.load(std::memory_order_relaxed); }
+  uint64_t unscheduledCalls() const { return m_unscheduled.load(std::memory_order_relaxed); }
+  uint64_t value(const Counter c) const { return m_values[c].load(std::memory_order_relaxed); }
+
+private:
+  const std::string m_name;
+  std::atomic<uint64_t> m_calls{0};
+  std::atomic<uint64_t> m_unscheduled{0};
+  std::array<std::atomic<uint64_t>, kNCounters> m_values{};
+};
+
+class PerfCounters {
+public:
+  struct Record {
+    std::string name;
+    uint64_t calls;
+    uint64_t unscheduled;
+    PerfStats::Values values;
+
+    // Derived metrics, NaN if a counter is not available (value kUnavailable)
+    double ipc() const;
+    double cacheMissRate() const;
+    double branchMissRate() const;
+  };
+
+  static PerfCounters& instance() {
+    // This is guaranteed to be thread-safe from C++11 onwards.
+    static PerfCounters counters;
+    return counters;
+  }
+
+  void enable(const bool value = true) { m_enabled.store(value, std::memory_order_relaxed); }
+  bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+  // Reason why counting does not work in this process (empty if it does, or if no thread
+  // tried to open its counters yet)
+  std::string unavailable() const;
+  // Value of counters that could not be opened
+  static constexpr uint64_t kUnavailable = UINT64_MAX;
+
+  // Counts for a name, created on first use. The reference stays valid until the end of
+  // the job, so hot code should look it up once.
+  PerfStats& stats(std::string_view name);
+
+  // Current raw counts of the calling thread, opening its counters on first use. Returns
+  // false if the counters are not available.
+  bool read(PerfStats::Sample& sample);
+
+  // All names with at least one (counted or unscheduled) call, sorted by decreasing number
+  // of cycles
+  std::vector<Record> records() const;
+  // Human-readable report, sorted by decreasing number of cycles
+  std::string report() const;
+  // Machine-readable CSV report, sorted by decreasing number of cycles
+  void write(const std::string& path) const;
+
+private:
+  PerfCounters() = default;
+
+  std::atomic<bool> m_enabled{false};
+  std::map<std::string, std::unique_ptr<PerfStats>, std::less<>> m_stats;
+  std::string m_unavailable;
+  // counters opened by the threads (bit mask of PerfStats::Counter)
+  std::atomic<uint32_t> m_available{0};
+  mutable std::mutex m_mutex;
+
+  friend struct PerfThreadCounters;
+
+public:
+  PerfCounters(const PerfCounters&) = delete;
+  void operator=(const PerfCounters&) = delete;
+};
+
+// Adds the counts of the calling thread during its lifetime to a PerfStats, if counting
+// is enabled and available
+class PerfScope {
+public:
+  explicit PerfScope(PerfStats& stats) : m_stats{stats} {
+    auto& counters = PerfCounters::instance();
+    m_active       = counters.enabled() && counters.read(m_begin);
+  }
+  explicit PerfScope(std::string_view name) : PerfScope{PerfCounters::instance().stats(name)} {}
+  ~PerfScope() {
+    PerfStats::Sample end;
+    if (!m_active || !PerfCounters::instance().read(end)) {
+      return;
+    }
+    // scale the raw deltas by the fraction of the scope the counters were running, as the
+    // cumulative scaling factor changes between reads
+    const uint64_t enabled = end.enabled - m_begin.enabled;
+    const uint64_t running = end.running - m_begin.running;
+    if (running == 0) {
+      m_stats.unscheduled();
+      return;
+    }
+    const double scale = running < enabled ? static_cast<double>(enabled) / running : 1.;
+    PerfStats::Values delta;
+    for (size_t i = 0; i < PerfStats::kNCounters; ++i) {
+      delta[i] = end.values[i] == PerfCounters::kUnavailable
+                     ? 0
+                     : static_cast<uint64_t>((end.values[i] - m_begin.values[i]) * scale);
+    }
+    m_stats.add(delta);
+  }
+  PerfScope(const PerfScope&) = delete;
+  void operator=(const PerfScope&) = delete;
+
+private:
+  PerfStats& m_stats;
+  PerfStats::Sample m_begin;
+  bool m_active;
+};
+
+} // namespace algorithms
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Startup profiling: records wall time, CPU time and peak RSS growth of every init()
+// step (services, geometry loading, algorithms), and reports them sorted by wall time
+// or as a CSV file.
+//
+// Services are profiled by ServiceSvc::init(), and algorithms by Algorithm::initialize()
+// (also used by AlgorithmPool). Algorithms that a framework initializes by calling init()
+// directly are not profiled. Use the RAII InitTimer to profile other steps:
+//
+//   {
+//     InitTimer timer{"algorithm", name()};
+//     ... // expensive initialization
+//   }
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fmt/format.h>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <vector>
+
+#include <algorithms/detail/csv.h>
+#include <algorithms/error.h>
+#include <algorithms/trace.h>
+
+namespace algorithms {
+
+class StartupProfiler {
+public:
+  struct Record {
+    std::string category; // e.g. service, geo, algorithm
+    std::string name;
+    double wall_ms;
+    double cpu_ms;     // CPU time of the initializing thread
+    long rss_delta_kb; // growth of the process peak RSS (approximate for parallel init)
+  };
+
+  static StartupProfiler& instance() {
+    // This is guaranteed to be thread-safe from C++11 onwards.
+    static StartupProfiler profiler;
+    return profiler;
+  }
+
+  void record(Record r) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_records.push_back(std::move(r));
+  }
+  // All records, sorted by decreasing wall time
+  std::vector<Record> records() const {
+    std::vector<Record> ret;
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      ret = m_records;
+    }
+    std::stable_sort(ret.begin(), ret.end(),
+                     [](const Record& a, const Record& b) { return a.wall_ms > b.wall_ms; });
+    return ret;
+  }
+  void clear() {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_records.clear();
+  }
+
+  // Human-readable report, sorted by decreasing wall time
+  std::string report() const {
+    const auto recs = records();
+    std::string ret = fmt::format("{:<10} {:<40} {:>12} {:>12} {:>14}\n", "category", "name",
+                                  "wall [ms]", "cpu [ms]", "peak RSS [kB]");
+    for (const auto& r : recs) {
+      ret += fmt::format("{:<10} {:<40} {:>12.2f} {:>12.2f} {:>+14}\n", r.category, r.name,
+                         r.wall_ms, r.cpu_ms, r.rss_delta_kb);
+    }
+    return ret;
+  }
+  // Machine-readable CSV report, sorted by decreasing wall time
+  void write(const std::string& path) const {
+    std::ofstream out{path};
+    if (!out) {
+      throw Error(fmt::format("Failed to open {} to write the startup profile", path),
+                  "algorithms::StartupProfiler");
+    }
+    out << "category,name,wall_ms,cpu_ms,rss_delta_kb\n";
+    for (const auto& r : records()) {
+      out << fmt::format("{},{},{:.3f},{:.3f},{}\n", detail::csvField(r.category),
+                         detail::csvField(r.name), r.wall_ms, r.cpu_ms, r.rss_delta_kb);
+    }
+  }
+
+private:
+  StartupProfiler() = default;
+
+  std::vector<Record> m_records;
+  mutable std::mutex m_mutex;
+
+public:
+  StartupProfiler(const StartupProfiler&) = delete;
+  void operator=(const StartupProfiler&) = delete;
+};
+
+// Records the duration of its own lifetime with the StartupProfiler, and as a span in the
+// execution timeline if tracing is enabled
+class InitTimer {
+public:
+  InitTimer(std::string_view category, std::string_view name)
+      : m_span{category, name}
+      , m_category{category}
+      , m_name{name}
+      , m_wall{std::chrono::steady_clock::now()}
+      , m_cpu{threadCpuTime()}
+      , m_rss{peakRss()} {}
+  ~InitTimer() {
+    const std::chrono::duration<double, std::milli> wall =
+        std::chrono::steady_clock::now() - m_wall;
+    StartupProfiler::instance().record(
+        {m_category, m_name, wall.count(), (threadCpuTime() - m_cpu) * 1e3, peakRss() - m_rss});
+  }
+  InitTimer(const InitTimer&) = delete;
+  void operator=(const InitTimer&) = delete;
+
+private:
+  static double threadCpuTime() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+  // peak resident set size of the process in kB
+  static long peakRss() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  const TraceSpan m_span;
+  const std::string m_category;
+  const std::string m_name;
+  const std::chrono::steady_clock::time_point m_wall;
+  const double m_cpu;
+  const long m_rss;
+};
+
+} // namespace algorithms
@@ -7,8 +7,14 @@
 //
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <variant>
 #include <vector>
@@ -18,7 +24,9 @@
 
 #include <algorithms/detail/upcast.h>
 #include <algorithms/error.h>
+#include <algorithms/matrix.h>
 #include <algorithms/name.h>
+#include <algorithms/shared_vector.h>
 
 namespace algorithms {
 
@@ -30,24 +38,208 @@ public:
 // Data types supported for Properties, defined as std::variant. This allows for
 // automatic Property registration with the calling framework, and enables compile-time
 // type errors.
-using PropertyValue = std::variant<bool, uint32_t, int32_t, uint64_t, int64_t, double, std::string,
-                                   std::vector<bool>, std::vector<uint32_t>, std::vector<int32_t>,
-                                   std::vector<uint64_t>, std::vector<int64_t>, std::vector<double>,
-                                   std::vector<std::string>>;
+// The SharedVector types are meant for large tables, they are shared (not copied) between
+// properties and PropertyValues. They can also be set from the corresponding std::vector.
+using PropertyValue =
+    std::variant<bool, uint32_t, int32_t, uint64_t, int64_t, double, std::string,
+                 std::vector<bool>, std::vector<uint32_t>, std::vector<int32_t>,
+                 std::vector<uint64_t>, std::vector<int64_t>, std::vector<double>,
+                 std::vector<std::string>, SharedVector<uint32_t>, SharedVector<int32_t>,
+                 SharedVector<uint64_t>, SharedVector<int64_t>, SharedVector<double>>;
+
+// Short names of the supported property types, in PropertyValue order
+constexpr std::array<std::string_view, std::variant_size_v<PropertyValue>> kPropertyTypeNames{
+    "bool",           "uint32",         "int32",          "uint64",         "int64",
+    "double",         "string",         "vector<bool>",   "vector<uint32>", "vector<int32>",
+    "vector<uint64>", "vector<int64>",  "vector<double>", "vector<string>", "shared<uint32>",
+    "shared<int32>",  "shared<uint64>", "shared<int64>",  "shared<double>"};
+
+namespace detail {
+  // Index of type T in the PropertyValue variant (compile error if not supported)
+  template <class T, size_t I = 0> constexpr size_t propertyTypeIndex() {
+    static_assert(I < std::variant_size_v<PropertyValue>, "Unsupported property type");
+    if constexpr (std::is_same_v<T, std::variant_alternative_t<I, PropertyValue>>) {
+      return I;
+    } else {
+      return propertyTypeIndex<T, I + 1>();
+    }
+  }
+  // Can a value of type index `actual` be assigned to a property of type index `expected`?
+  // (identical types, or a std::vector for the corresponding SharedVector)
+  template <size_t I = 0> constexpr bool propertyTypeAccepts(const size_t expected,
+                                                             const size_t actual) {
+    if constexpr (I == std::variant_size_v<PropertyValue>) {
+      return false;
+    } else {
+      using T = std::variant_alternative_t<I, PropertyValue>;
+      if (expected == I) {
+        if constexpr (is_shared_vector_v<T>) {
+          return actual == I ||
+                 actual == propertyTypeIndex<std::vector<typename T::value_type>>();
+        }
+        return actual == I;
+      }
+      return propertyTypeAccepts<I + 1>(expected, actual);
+    }
+  }
+} // namespace detail
+
+// Static description of a single property, known without creating its owner
+struct PropertyInfo {
+  std::string_view name;
+  size_t type; // index in PropertyValue
+  std::string_view description;
+  std::optional<PropertyValue> defaultValue;
+
+  std::string_view typeName() const { return kPropertyTypeNames[type]; }
+};
+
+// Property declaration that can be shared between the Property<T> member of a Configurable
+// and the static PropertySchema of its class, e.g.
+//
+//   static inline const PropertySpec<double> kThreshold{"threshold", "Energy threshold", 1.};
+//   Property<double> m_threshold{this, kThreshold};
+//   static const PropertySchema& propertySchema() {
+//     static const PropertySchema schema{kThreshold.info()};
+//     return schema;
+//   }
+template <class T> struct PropertySpec {
+  using value_type = T;
+  using impl_type  = detail::upcast_type_t<T>;
+
+  std::string_view name;
+  std::string_view description;
+  std::optional<T> defaultValue = std::nullopt;
+
+  PropertyInfo info() const {
+    std::optional<PropertyValue> def;
+    if (defaultValue) {
+      def = detail::upcast(*defaultValue);
+    }
+    return {name, detail::propertyTypeIndex<impl_type>(), description, def};
+  }
+};
+
+// Static property schema of a Configurable class, allows listing and validating
+// a configuration without instantiating the class
+class PropertySchema {
+public:
+  using ConfigType = std::map<std::string, PropertyValue, std::less<>>;
+
+  PropertySchema(std::initializer_list<PropertyInfo> props) : m_props{props} {}
+
+  const std::vector<PropertyInfo>& properties() const { return m_props; }
+  const PropertyInfo* find(std::string_view name) const {
+    for (const auto& prop : m_props) {
+      if (prop.name == name) {
+        return &prop;
+      }
+    }
+    return nullptr;
+  }
+  // Throw an exception if the configuration contains unknown properties or values of
+  // the wrong type, or if properties without default value are missing
+  void validate(const ConfigType& config) const {
+    std::vector<std::string> errors;
+    for (const auto& [name, value] : config) {
+      const auto* prop = find(name);
+      if (!prop) {
+        errors.push_back(fmt::format("unknown property {}", name));
+      } else if (!detail::propertyTypeAccepts(prop->type, value.index())) {
+        errors.push_back(fmt::format("property {} should be of type {}, not {}", name,
+                                     prop->typeName(), kPropertyTypeNames[value.index()]));
+      }
+    }
+    for (const auto& prop : m_props) {
+      if (!prop.defaultValue && !config.count(prop.name)) {
+        errors.push_back(fmt::format("missing property {}", prop.name));
+      }
+    }
+    if (!errors.empty()) {
+      throw PropertyError(fmt::format("Invalid configuration: {}", fmt::join(errors, ", ")));
+    }
+  }
+
+private:
+  std::vector<PropertyInfo> m_props;
+};
+
+namespace detail {
+  // Convert a PropertyValue to the value type T of a property
+  //  - fixed-size types (std::array, Matrix) are validated to have the correct size
+  //  - SharedVector<T> can be set from a std::vector<T>, which is then deduplicated
+  template <class T> T propertyCast(const PropertyValue& v, std::string_view name) {
+    using impl_type = upcast_type_t<T>;
+    if constexpr (is_fixed_size_v<T>) {
+      const auto& values = std::get<impl_type>(v);
+      if (values.size() != fixed_size_v<T>) {
+        throw PropertyError(fmt::format("Property {} requires exactly {} values, got {}", name,
+                                        fixed_size_v<T>, values.size()));
+      }
+      T ret;
+      std::transform(values.begin(), values.end(), ret.begin(), [](const auto& x) {
+        return static_cast<typename T::value_type>(x);
+      });
+      return ret;
+    } else if constexpr (is_shared_vector_v<T>) {
+      // share the storage if possible, otherwise deduplicate a copy of the vector
+      using vector_type = std::vector<typename T::value_type>;
+      if (const auto* values = std::get_if<vector_type>(&v)) {
+        return T{*values};
+      }
+      return std::get<T>(v);
+    } else {
+      return static_cast<T>(std::get<impl_type>(v));
+    }
+  }
+} // namespace detail
 
 // Configuration/property handling
+//
+// Besides the PropertyValue types, properties can also be fixed-size std::array<T, N> or
+// Matrix<T, R, C>. These are stored inline in the Property, transported as a vector of the
+// (upcast) element type, and their size is checked when they are set.
 class Configurable {
 public:
   class PropertyBase;
   using PropertyMap = std::map<std::string_view, PropertyBase&>;
 
   template <typename T> void setProperty(std::string_view name, T&& value) {
-    m_props.at(name).set(static_cast<detail::upcast_type_t<T>>(value));
+    m_props.at(name).set(detail::upcast(std::forward<T>(value)));
   }
   template <typename T> T getProperty(std::string_view name) const {
     return std::get<T>(m_props.at(name).get());
   }
   const PropertyMap& getProperties() const { return m_props; }
+  // Set many properties at once from (name, value) pairs that are sorted by name. The
+  // properties are assigned in a single merge pass over the (sorted) property map instead
+  // of a map lookup per property. Throws on unknown names or values of the wrong type.
+  template <class Pairs> void setProperties(const Pairs& sorted) {
+    auto it = m_props.begin();
+    for (const auto& [name, value] : sorted) {
+      while (it != m_props.end() && it->first < name) {
+        ++it;
+      }
+      if (it == m_props.end() || it->first != name) {
+        throw PropertyError(fmt::format("Unknown (or unsorted) property name: {}", name));
+      }
+      try {
+        it->second.set(value);
+      } catch (const std::bad_variant_access&) {
+        throw PropertyError(fmt::format("Wrong value type {} for property {}",
+                                        kPropertyTypeNames[value.index()], name));
+      }
+    }
+  }
+  // Copy the values of all set properties from another Configurable of the same type
+  // (e.g. to create an identically configured clone of an algorithm)
+  void copyProperties(const Configurable& other) {
+    for (const auto& [name, prop] : other.m_props) {
+      if (prop.hasValue()) {
+        m_props.at(name).set(prop.get());
+      }
+    }
+  }
   bool hasProperty(std::string_view name) const {
     return m_props.count(name) && m_props.at(name).hasValue();
   }
@@ -86,7 +278,9 @@ public:
         : NameMixin{name, description} {}
     virtual void set(const PropertyValue& v) = 0;
     virtual PropertyValue get() const        = 0;
-    bool hasValue() const { return m_has_value; }
+    // index of the (upcast) value type in PropertyValue
+    virtual size_t typeIndex() const = 0;
+    virtual bool hasValue() const { return m_has_value; }
 
   protected:
     bool m_has_value = false;
@@ -111,7 +305,13 @@ public:
     Property(Configurable* owner, std::string_view name, const value_type& v,
              std::string_view description)
         : Property(owner, name, description) {
-      set(static_cast<impl_type>(v));
+      set(detail::upcast(v));
+    }
+    Property(Configurable* owner, const PropertySpec<T>& spec)
+        : Property(owner, spec.name, spec.description) {
+      if (spec.defaultValue) {
+        set(detail::upcast(*spec.defaultValue));
+      }
     }
 
     Property()                = delete;
@@ -120,13 +320,15 @@ public:
 
     // Only settable by explicitly calling the ::set() member function
     // as we want the Property to mostly act as if it is constant
+    // Fixed-size types (std::array, Matrix) are validated to have the correct size.
     virtual void set(const PropertyValue& v) {
-      m_value     = static_cast<value_type>(std::get<impl_type>(v));
+      m_value     = detail::propertyCast<value_type>(v, name());
       m_has_value = true;
     }
     // virtual getter for use from PropertyBase - use ::value() instead for direct member
     // access
-    virtual PropertyValue get() const { return static_cast<impl_type>(m_value); }
+    virtual PropertyValue get() const { return detail::upcast(m_value); }
+    virtual size_t typeIndex() const { return detail::propertyTypeIndex<impl_type>(); }
 
     // Direct access to the value. Use this one whenever possible (or go through the
     // automatic casting)
@@ -178,6 +380,101 @@ public:
   private:
     T m_value;
   };
+
+  // Opt-in property type that can safely be updated while other threads are reading it,
+  // e.g. to change a threshold between events without stopping the job. Every set()
+  // publishes a new immutable versioned snapshot (RCU-style). Readers never lock: they
+  // pick up the current snapshot with a single atomic load, and should do so once per
+  // event so that all of its processing sees a consistent value:
+  //
+  //   const auto& threshold = m_threshold.snapshot(); // at the start of process()
+  //
+  // Writers are serialized. Replaced snapshots are retired rather than deleted, as readers
+  // may still be using them, so every set() keeps the previous value alive. Retired
+  // snapshots are only freed on destruction or by reclaim(): a framework that updates live
+  // properties during the job should call reclaim() at a quiescent point where no reader
+  // can hold an old snapshot, e.g. after an update once the events in flight have finished.
+  template <class T> class LiveProperty : public PropertyBase {
+  public:
+    using value_type = T;
+    using impl_type  = detail::upcast_type_t<T>;
+
+    struct Snapshot {
+      T value;
+      uint64_t version;
+    };
+
+    LiveProperty(Configurable* owner, std::string_view name, std::string_view description)
+        : PropertyBase{name, description} {
+      if (owner) {
+        owner->registerProperty(*this);
+      } else {
+        throw PropertyError(
+            fmt::format("Attempting to create Property '{}' without valid owner", name));
+      }
+    }
+    LiveProperty(Configurable* owner, std::string_view name, const value_type& v,
+                 std::string_view description)
+        : LiveProperty(owner, name, description) {
+      set(detail::upcast(v));
+    }
+    LiveProperty(Configurable* owner, const PropertySpec<T>& spec)
+        : LiveProperty(owner, spec.name, spec.description) {
+      if (spec.defaultValue) {
+        set(detail::upcast(*spec.defaultValue));
+      }
+    }
+    LiveProperty(const LiveProperty&) = delete;
+    void operator=(const LiveProperty&) = delete;
+    ~LiveProperty() { delete m_current.load(); }
+
+    virtual void set(const PropertyValue& v) {
+      auto value = detail::propertyCast<value_type>(v, name());
+      std::lock_guard<std::mutex> lock{m_writer_mutex};
+      const auto* current    = m_current.load(std::memory_order_relaxed);
+      const uint64_t version = current ? current->version + 1 : 0;
+      const auto* previous =
+          m_current.exchange(new Snapshot{std::move(value), version}, std::memory_order_acq_rel);
+      if (previous) {
+        m_retired.emplace_back(previous);
+      }
+    }
+    virtual PropertyValue get() const { return detail::upcast(snapshot().value); }
+    virtual size_t typeIndex() const { return detail::propertyTypeIndex<impl_type>(); }
+    // set() may run concurrently, so this does not use the (non-atomic) flag of the base
+    virtual bool hasValue() const { return m_current.load(std::memory_order_acquire) != nullptr; }
+
+    // Current snapshot (single atomic load), stays valid until reclaim() is called
+    const Snapshot& snapshot() const {
+      const auto* current = m_current.load(std::memory_order_acquire);
+      if (!current) {
+        throw PropertyError(fmt::format("Attempting to read unset Property '{}'", name()));
+      }
+      return *current;
+    }
+    const value_type& value() const { return snapshot().value; }
+    uint64_t version() const { return snapshot().version; }
+
+    // Free all retired snapshots, returns the number of snapshots freed. Only call this
+    // when no reader can still hold a reference to an older snapshot: references obtained
+    // before reclaim() dangle afterwards.
+    size_t reclaim() {
+      std::lock_guard<std::mutex> lock{m_writer_mutex};
+      const size_t n = m_retired.size();
+      m_retired.clear();
+      return n;
+    }
+    // Number of retired snapshots waiting for reclaim()
+    size_t retired() const {
+      std::lock_guard<std::mutex> lock{m_writer_mutex};
+      return m_retired.size();
+    }
+
+  private:
+    std::atomic<const Snapshot*> m_current{nullptr};
+    std::vector<std::unique_ptr<const Snapshot>> m_retired;
+    mutable std::mutex m_writer_mutex;
+  };
 }; // namespace algorithms
 
 // Property mixin, provides all the configuration functionality for
@@ -0,0 +1,515 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Standalone algorithm replay: an EventRecorder captures the inputs and outputs of one
+// algorithm during a full job into a columnar EventFile, and an EventReplay later feeds
+// the recorded inputs to process() without the host framework or its I/O, for isolated
+// throughput measurements and output regression checks.
+//
+// Every Input<> and Output<> argument of the algorithm is a column, holding 0 or more
+// values per event (one for T, at most one for std::optional<T>, any number for
+// std::vector<T>). Values are encoded with EventCodec<T>: trivially copyable types are
+// stored as-is and replayed in place from the memory-mapped file (zero-copy), other types
+// (e.g. podio collections) need a specialization of EventCodec. check() compares outputs
+// with operator== where available, other types are compared by their encoding, which for
+// the default codec requires a unique object representation (no padding bytes or floating
+// point members).
+//
+//   // in the full job, after each call of process()
+//   recorder.record(input, output);
+//   // at the end of the job
+//   recorder.write();
+//
+//   // standalone
+//   EventReplay<MyAlgorithm::algorithm_type> replay{"events.bin", algo};
+//   const double seconds_per_event = replay.benchmark(algo, 10);
+//   const auto mismatches          = replay.check(algo);
+//
+// Binary format (native byte order), columns in argument order, inputs first:
+//   header: magic "ALGOEVT\0", uint32 byte-order marker, uint32 version,
+//           uint32 number of columns, uint64 number of events, uint64 payload size,
+//           uint64 payload checksum (FNV-1a)
+//   column: string name ("input:<name>" or "output:<name>"), string value type,
+//           uint32 value size (0 for variable size values), uint64 data size,
+//           zero padding up to the next 8-byte aligned file offset,
+//           uint64 offsets in the data of each event (number of events + 1), data
+//   data:   values of each event, each starting at an 8-byte aligned offset; variable
+//           size values are prefixed with their uint64 size
+//   string: uint32 length + bytes
+//
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <gsl/gsl>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <algorithms/detail/demangle.h>
+#include <algorithms/detail/mapped_file.h>
+#include <algorithms/error.h>
+#include <algorithms/status.h>
+#include <algorithms/type_traits.h>
+
+namespace algorithms {
+
+class EventFileError : public Error {
+public:
+  EventFileError(std::string_view msg) : Error{msg, "algorithms::EventFileError"} {}
+};
+
+namespace detail {
+  // Base of the default EventCodec, to tell it apart from specializations
+  struct RawEventCodec {};
+} // namespace detail
+
+// Encoding of recorded values. The default stores trivially copyable types as-is, values
+// with an alignment of at most 8 bytes are then used in place from the mapped file.
+// Specializations for other types provide the same members, with kSize = 0 (variable size)
+// and kInPlace = false:
+//   static void encode(const T& value, std::string& out); // append the encoded value
+//   static T decode(gsl::span<const std::byte> data);
+template <class T> struct EventCodec : detail::RawEventCodec {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "algorithms::EventCodec<T> needs to be specialized for this type");
+  static constexpr uint32_t kSize = sizeof(T);
+  static constexpr bool kInPlace  = alignof(T) <= 8;
+
+  static void encode(const T& value, std::string& out) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  static T decode(gsl::span<const std::byte> data) {
+    T value;
+    std::memcpy(&value, data.data(), sizeof(T));
+    return value;
+  }
+};
+
+class EventFile {
+public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kAlignment = 8;
+
+  // Column to write
+  struct ColumnData {
+    std::string name;
+    std::string type;
+    uint32_t value_size = 0;
+    std::vector<uint64_t> offsets{0}; // one more than the number of events
+    std::string data;
+  };
+  // View on one column of a mapped file
+  struct Column {
+    std::string_view name;
+    std::string_view type;
+    uint32_t value_size;
+    gsl::span<const uint64_t> offsets;
+    gsl::span<const std::byte> data;
+
+    gsl::span<const std::byte> event(const size_t i) const {
+      return data.subspan(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+  };
+
+  // Write an event file, all columns need the same number of events
+  static void write(const std::string& path, const std::vector<ColumnData>& columns);
+
+  // Map and validate an event file, throws EventFileError if the file is invalid
+  explicit EventFile(const std::string& path);
+
+  const std::string& path() const { return m_file.path(); }
+  size_t size() const { return m_nevents; }
+  const std::vector<Column>& columns() const { return m_columns; }
+  // Column with the given name and value type, throws EventFileError if not present
+  const Column& column(std::string_view name, std::string_view type) const;
+
+  // padding needed to align an offset
+  static size_t padding(const size_t offset) {
+    return (kAlignment - offset % kAlignment) % kAlignment;
+  }
+
+private:
+  detail::MappedFile m_file;
+  uint64_t m_nevents = 0;
+  std::vector<Column> m_columns;
+};
+
+namespace detail {
+  // Append a value to the data of a column, see the format description above
+  template <class T> void appendValue(std::string& data, const T& value) {
+    using Codec        = EventCodec<T>;
+    const size_t start = data.size();
+    if constexpr (Codec::kSize == 0) {
+      data.append(sizeof(uint64_t), '\0');
+    }
+    Codec::encode(value, data);
+    if constexpr (Codec::kSize == 0) {
+      const uint64_t size = data.size() - start - sizeof(uint64_t);
+      std::memcpy(data.data() + start, &size, sizeof(uint64_t));
+    } else if (data.size() - start != Codec::kSize) {
+      throw EventFileError(fmt::format("EventCodec<{}> encoded {} bytes, expected {}",
+                                       typeName<T>(), data.size() - start, Codec::kSize));
+    }
+    data.append(EventFile::padding(data.size()), '\0');
+  }
+  // Append all values of an algorithm argument (pointer, optional pointer or vector)
+  template <class T, class Arg> void appendArgument(std::string& data, const Arg& arg) {
+    if constexpr (is_vector_v<T>) {
+      for (const auto& ptr : arg) {
+        appendValue(data, *ptr);
+      }
+    } else if constexpr (is_optional_v<T>) {
+      if (arg) {
+        appendValue(data, *arg);
+      }
+    } else {
+      appendValue(data, *arg);
+    }
+  }
+  // Pointers to all values of an algorithm argument (pointer, optional pointer or vector)
+  template <class T, class Arg> std::vector<const data_type_t<T>*> argumentValues(const Arg& arg) {
+    std::vector<const data_type_t<T>*> ret;
+    if constexpr (is_vector_v<T>) {
+      for (const auto& ptr : arg) {
+        ret.push_back(ptr);
+      }
+    } else if constexpr (is_optional_v<T>) {
+      if (arg) {
+        ret.push_back(arg);
+      }
+    } else {
+      ret.push_back(arg);
+    }
+    return ret;
+  }
+  // Split the data of an event into its encoded values
+  template <class T>
+  std::vector<gsl::span<const std::byte>> splitValues(gsl::span<const std::byte> event) {
+    using Codec = EventCodec<T>;
+    std::vector<gsl::span<const std::byte>> ret;
+    size_t pos = 0;
+    while (pos < event.size()) {
+      size_t size = Codec::kSize;
+      if constexpr (Codec::kSize == 0) {
+        if (event.size() - pos < sizeof(uint64_t)) {
+          throw EventFileError("truncated value size");
+        }
+        uint64_t n;
+        std::memcpy(&n, event.data() + pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+        size = n;
+      }
+      if (size > event.size() - pos) {
+        throw EventFileError("truncated value");
+      }
+      ret.push_back(event.subspan(pos, size));
+      pos += size + EventFile::padding(size);
+    }
+    return ret;
+  }
+  inline std::string columnName(std::string_view kind, std::string_view name) {
+    return fmt::format("{}:{}", kind, name);
+  }
+} // namespace detail
+
+// Records the arguments of an algorithm, for all events passed to record()
+template <class AlgoType> class EventRecorder {
+public:
+  using Input       = typename AlgoType::Input;
+  using Output      = typename AlgoType::Output;
+  using input_data  = typename AlgoType::input_type::data_type;
+  using output_data = typename AlgoType::output_type::data_type;
+
+  EventRecorder(const std::string& path, const AlgoType& algo) : m_path{path} {
+    addColumns<input_data>("input", algo.inputNames(),
+                           std::make_index_sequence<std::tuple_size_v<input_data>>());
+    addColumns<output_data>("output", algo.outputNames(),
+                            std::make_index_sequence<std::tuple_size_v<output_data>>());
+  }
+
+  // Record one event, typically right after process(). Thread-safe.
+  void record(const Input& input, const Output& output) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    append<input_data>(input, 0, std::make_index_sequence<std::tuple_size_v<input_data>>());
+    append<output_data>(output, std::tuple_size_v<input_data>,
+                        std::make_index_sequence<std::tuple_size_v<output_data>>());
+    for (auto& column : m_columns) {
+      column.offsets.push_back(column.data.size());
+    }
+    ++m_nevents;
+  }
+  size_t size() const {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_nevents;
+  }
+  // Write all recorded events, e.g. at the end of the job
+  void write() const {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    EventFile::write(m_path, m_columns);
+  }
+
+private:
+  template <class Data, size_t... I>
+  void addColumns(std::string_view kind, const auto& names, std::index_sequence<I...>) {
+    (m_columns.push_back({detail::columnName(kind, names[I]),
+                          detail::typeName<data_type_t<std::tuple_element_t<I, Data>>>(),
+                          EventCodec<data_type_t<std::tuple_element_t<I, Data>>>::kSize,
+                          {0},
+                          {}}),
+     ...);
+  }
+  template <class Data, class Args, size_t... I>
+  void append(const Args& args, const size_t first, std::index_sequence<I...>) {
+    (detail::appendArgument<std::tuple_element_t<I, Data>>(m_columns[first + I].data,
+                                                           std::get<I>(args)),
+     ...);
+  }
+
+  const std::string m_path;
+  std::vector<EventFile::ColumnData> m_columns;
+  size_t m_nevents = 0;
+  mutable std::mutex m_mutex;
+};
+
+// Replays the events of an EventFile into an algorithm. All inputs are resolved when the
+// file is opened, so replay only calls execute() and creates the output objects, like a
+// framework would.
+template <class AlgoType> class EventReplay {
+public:
+  using Input       = typename AlgoType::Input;
+  using Output      = typename AlgoType::Output;
+  using input_data  = typename AlgoType::input_type::data_type;
+  using output_data = typename AlgoType::output_type::data_type;
+
+  static constexpr size_t kNInputs  = std::tuple_size_v<input_data>;
+  static constexpr size_t kNOutputs = std::tuple_size_v<output_data>;
+
+  // Map the file and resolve the recorded values for the argument names of algo, throws
+  // EventFileError if the file does not match the algorithm
+  EventReplay(const std::string& path, const AlgoType& algo) : m_file{path} {
+    // the file itself was validated by EventFile
+    try {
+      resolveInputs(algo, std::make_index_sequence<kNInputs>());
+      resolveOutputs(algo, std::make_index_sequence<kNOutputs>());
+    } catch (const Error& e) {
+      throw EventFileError(fmt::format("Event file {} does not match algorithm {}: {}", path,
+                                       algo.name(), e.what()));
+    }
+  }
+
+  size_t size() const { return m_file.size(); }
+  const Input& input(const size_t event) const { return m_inputs[event]; }
+
+  // Process all events the given number of times, and return the average wall time per
+  // event in seconds. This includes the creation of the output objects, as in a framework.
+  double benchmark(const AlgoType& algo, const size_t passes = 1) const {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass) {
+      for (size_t i = 0; i < size(); ++i) {
+        OutputStorage outputs = makeOutputs(i, std::make_index_sequence<kNOutputs>());
+        algo.execute(m_inputs[i], outputArgs(outputs, std::make_index_sequence<kNOutputs>()));
+      }
+    }
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    return size() * passes > 0 ? time.count() / (size() * passes) : 0.;
+  }
+  // Process all events once, and compare the encoded outputs with the recorded ones.
+  // Returns the events with different outputs, or for which execute() fails. The recorder
+  // does not store the processing status, so events that already failed in the recorded
+  // job are returned as well.
+  std::vector<size_t> check(const AlgoType& algo) const {
+    std::vector<size_t> ret;
+    for (size_t i = 0; i < size(); ++i) {
+      OutputStorage outputs = makeOutputs(i, std::make_index_sequence<kNOutputs>());
+      const auto output     = outputArgs(outputs, std::make_index_sequence<kNOutputs>());
+      if (!algo.execute(m_inputs[i], output) ||
+          !sameOutputs(i, output, std::make_index_sequence<kNOutputs>())) {
+        ret.push_back(i);
+      }
+    }
+    return ret;
+  }
+
+private:
+  template <class T> using value_t = data_type_t<T>;
+  // Output objects of a single event, as many as were recorded for each argument
+  template <class... T> static std::tuple<std::vector<value_t<T>>...> storageOf(std::tuple<T...>*);
+  using OutputStorage = decltype(storageOf(static_cast<output_data*>(nullptr)));
+
+  template <size_t... I> void resolveInputs(const AlgoType& algo, std::index_sequence<I...>) {
+    std::array<std::vector<std::vector<const void*>>, kNInputs> values{
+        resolveValues<value_t<std::tuple_element_t<I, input_data>>>(
+            detail::columnName("input", algo.inputNames()[I]))...};
+    const std::array<std::string, kNInputs> names{
+        detail::columnName("input", algo.inputNames()[I])...};
+    m_inputs.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+      m_inputs.push_back(
+          Input{makeArg<std::tuple_element_t<I, input_data>>(values[I][i], names[I], i)...});
+    }
+  }
+  template <size_t... I> void resolveOutputs(const AlgoType& algo, std::index_sequence<I...>) {
+    m_output_counts.resize(size());
+    (resolveOutput<I>(detail::columnName("output", algo.outputNames()[I])), ...);
+  }
+  template <size_t I> void resolveOutput(const std::string& name) {
+    using V            = value_t<std::tuple_element_t<I, output_data>>;
+    const auto& column = m_file.column(name, detail::typeName<V>());
+    if (column.value_size != EventCodec<V>::kSize) {
+      throw EventFileError(fmt::format("column {} has values of {} bytes, expected {}", name,
+                                       column.value_size, EventCodec<V>::kSize));
+    }
+    for (size_t i = 0; i < size(); ++i) {
+      const size_t count = detail::splitValues<V>(column.event(i)).size();
+      checkCount<std::tuple_element_t<I, output_data>>(count, name, i);
+      m_output_counts[i][I] = count;
+    }
+    m_outputs[I] = &column;
+  }
+
+  // Pointers to all values of a column for each event, in place in the mapped file or
+  // decoded into owned storage
+  template <class T> std::vector<std::vector<const void*>> resolveValues(const std::string& name) {
+    using Codec        = EventCodec<T>;
+    const auto& column = m_file.column(name, detail::typeName<T>());
+    if (column.value_size != Codec::kSize) {
+      throw EventFileError(fmt::format("column {} has values of {} bytes, expected {}", name,
+                                       column.value_size, Codec::kSize));
+    }
+    std::vector<std::vector<const void*>> ret(size());
+    for (size_t i = 0; i < size(); ++i) {
+      for (const auto& value : detail::splitValues<T>(column.event(i))) {
+        if constexpr (Codec::kInPlace) {
+          ret[i].push_back(value.data());
+        } else {
+          auto& storage = decoded<T>();
+          storage.push_back(Codec::decode(value));
+          ret[i].push_back(&storage.back());
+        }
+      }
+    }
+    return ret;
+  }
+  template <class T> std::deque<T>& decoded() {
+    auto& ptr = m_decoded[detail::typeName<T>()];
+    if (!ptr) {
+      ptr = std::make_shared<std::deque<T>>();
+    }
+    return *std::static_pointer_cast<std::deque<T>>(ptr);
+  }
+
+  // Throw if the number of values of an event does not fit the argument (exactly one for
+  // T, at most one for std::optional<T>)
+  template <class T>
+  static void checkCount(const size_t count, std::string_view column, const size_t event) {
+    if (!is_vector_v<T> && (count > 1 || (!is_optional_v<T> && count == 0))) {
+      throw EventFileError(
+          fmt::format("{} values in column {} for event {}", count, column, event));
+    }
+  }
+  // Input argument from the values of an event, checking the number of values
+  template <class T>
+  static input_type_t<T> makeArg(const std::vector<const void*>& values,
+                                 std::string_view column, const size_t event) {
+    using V = value_t<T>;
+    checkCount<T>(values.size(), column, event);
+    if constexpr (is_vector_v<T>) {
+      std::vector<gsl::not_null<const V*>> ret;
+      for (const auto* v : values) {
+        ret.emplace_back(static_cast<const V*>(v));
+      }
+      return ret;
+    } else {
+      const V* ptr = values.empty() ? nullptr : static_cast<const V*>(values[0]);
+      if constexpr (is_optional_v<T>) {
+        return ptr;
+      } else {
+        return gsl::not_null<const V*>{ptr};
+      }
+    }
+  }
+
+  template <size_t... I>
+  OutputStorage makeOutputs(const size_t event, std::index_sequence<I...>) const {
+    return OutputStorage{
+        std::vector<value_t<std::tuple_element_t<I, output_data>>>(m_output_counts[event][I])...};
+  }
+  template <size_t... I>
+  static Output outputArgs(OutputStorage& storage, std::index_sequence<I...>) {
+    return Output{outputArg<std::tuple_element_t<I, output_data>>(std::get<I>(storage))...};
+  }
+  template <class T> static output_type_t<T> outputArg(std::vector<value_t<T>>& values) {
+    using V = value_t<T>;
+    if constexpr (is_vector_v<T>) {
+      std::vector<gsl::not_null<V*>> ret;
+      for (auto& v : values) {
+        ret.emplace_back(&v);
+      }
+      return ret;
+    } else if constexpr (is_optional_v<T>) {
+      return values.empty() ? nullptr : &values[0];
+    } else {
+      return gsl::not_null<V*>{&values[0]};
+    }
+  }
+
+  template <size_t... I>
+  bool sameOutputs(const size_t event, const Output& output, std::index_sequence<I...>) const {
+    return (sameOutput<std::tuple_element_t<I, output_data>>(m_outputs[I]->event(event),
+                                                              std::get<I>(output)) &&
+            ...);
+  }
+  // Identical encodings are the same output, otherwise the recorded values are decoded and
+  // compared with operator== (e.g. for padding bytes, or -0. and 0.)
+  template <class T, class Arg>
+  static bool sameOutput(gsl::span<const std::byte> recorded, const Arg& arg) {
+    using V = value_t<T>;
+    std::string data;
+    detail::appendArgument<T>(data, arg);
+    if (data.size() == recorded.size() &&
+        std::memcmp(data.data(), recorded.data(), data.size()) == 0) {
+      return true;
+    }
+    if constexpr (std::equality_comparable<V>) {
+      const auto values   = detail::splitValues<V>(recorded);
+      const auto produced = detail::argumentValues<T>(arg);
+      if (values.size() != produced.size()) {
+        return false;
+      }
+      for (size_t i = 0; i < values.size(); ++i) {
+        if (!(EventCodec<V>::decode(values[i]) == *produced[i])) {
+          return false;
+        }
+      }
+      return true;
+    } else {
+      static_assert(!std::is_base_of_v<detail::RawEventCodec, EventCodec<V>> ||
+                        std::has_unique_object_representations_v<V>,
+                    "Output types recorded with the default algorithms::EventCodec need an "
+                    "operator== to be compared, unless they have a unique object "
+                    "representation");
+      return false;
+    }
+  }
+
+  EventFile m_file;
+  std::vector<Input> m_inputs;
+  std::array<const EventFile::Column*, kNOutputs> m_outputs{};
+  // number of recorded values of each output argument for each event
+  std::vector<std::array<size_t, kNOutputs>> m_output_counts;
+  std::map<std::string, std::shared_ptr<void>, std::less<>> m_decoded;
+};
+
+} // namespace algorithms
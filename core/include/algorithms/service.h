@@ -6,13 +6,32 @@
 // Provides the special ServiceSvc (that provides access to all instantiated services as
 // Configurable*), and the ServiceMixin (and related ALGORITHMS_DEFINE_SERVICE macro).
 //
+// Services can declare the services they depend on, either through a static
+//   constexpr std::array<std::string_view, N> kDependencies{"OtherSvc", ...};
+// member, or through ServiceSvc::setDependencies<Svc>(). Base classes can add implicit
+// dependencies through a kImplicitDependencies member, which setDependencies() does not
+// override: every LoggedService depends on the LogSvc this way.
+//
+// Ordering rules of ServiceSvc::init():
+//  - a service is only initialized after all of its (explicit and implicit) dependencies,
+//    so e.g. a framework LogSvc initializer (setInit()) that installs the log action
+//    always completes before any LoggedService is initialized
+//  - with a single thread (the default), services are initialized one at a time, in
+//    registration order whenever the dependencies allow
+//  - with more threads, services whose dependencies are satisfied are initialized
+//    concurrently, in no particular order. A service that uses another service in its
+//    init() must declare it as a dependency.
+//
 #pragma once
 
+#include <algorithm>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <algorithms/error.h>
 #include <algorithms/name.h>
@@ -63,19 +82,38 @@ public:
     static ServiceSvc svc;
     return svc;
   }
-  // add a service to the ServiceSvc. Two options:
+  // add a service to the ServiceSvc. Three options:
   // - prior to init --> just add the service to the service stack and set the initializer
+  // - during init   --> throws, as the (possibly parallel) initialization is iterating over
+  //                     the services. Register the service before, and declare it as a
+  //                     dependency of the services that use it in their init().
   // - after init    --> add service to call stack, set the initializer,
   //                     manually call init for the service, revalidate
   template <class Svc>
   void add(
       ServiceBase* svc, const std::function<void(Svc&)>& init = [](Svc& s) { s.init(); }) {
-    m_keys.push_back(Svc::kName);
-    m_services[Svc::kName] = svc;
-    // only add initializer if not already present (e.g. if for some reason the framework did
-    // the registration early)
-    if (m_initializers.count(Svc::kName) == 0) {
-      setInit(init);
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      if (m_initializing) {
+        throw ServiceError(fmt::format("Service {} was first used during ServiceSvc::init(), "
+                                       "it should be registered (by calling instance()) and "
+                                       "declared as a dependency before",
+                                       Svc::kName));
+      }
+      m_keys.push_back(Svc::kName);
+      m_services[Svc::kName] = svc;
+      if constexpr (requires { Svc::kDependencies; }) {
+        m_dependencies[Svc::kName] = {Svc::kDependencies.begin(), Svc::kDependencies.end()};
+      }
+      if constexpr (requires { Svc::kImplicitDependencies; }) {
+        m_implicit_dependencies[Svc::kName] = {Svc::kImplicitDependencies.begin(),
+                                               Svc::kImplicitDependencies.end()};
+      }
+      // only add initializer if not already present (e.g. if for some reason the framework
+      // did the registration early)
+      if (m_initializers.count(Svc::kName) == 0) {
+        setInit(init);
+      }
     }
     // call init if we are already in an initialized state (this is a straggler)
     if (m_init) {
@@ -88,37 +126,34 @@ public:
   template <class Svc> void setInit(const std::function<void(Svc&)>& init) {
     m_initializers[Svc::kName] = [init]() { init(Svc::instance()); };
   }
-
-  // Loop over all services in order and initialize one-by-one
-  // Finalize by validating that all is well
-  void init() {
-    // ensure we only call init once
-    if (m_init) {
-      throw ServiceError("Cannot initialize services twice");
-    }
-    // Call init for all the services and mark as ready
-    for (const auto& name : m_keys) {
-      try {
-        m_initializers.at(name)();
-      } catch (const std::exception& e) {
-        // we encountered an issue, stop here so validation fails
-        break;
-      }
-      auto svc = m_services.at(name);
-      // Ensure our init made sense -- cannot have missing properties at this stage
-      if (svc->missingProperties().size() > 0) {
-        break;
+  // Declare (or override) the services that need to be initialized before Svc, in
+  // addition to its implicit dependencies
+  template <class Svc> void setDependencies(const std::vector<std::string_view>& deps) {
+    m_dependencies[Svc::kName] = deps;
+  }
+  // All services that need to be initialized before a service, implicit ones first
+  std::vector<std::string_view> dependencies(std::string_view name) const {
+    std::vector<std::string_view> ret;
+    for (const auto* deps : {&m_implicit_dependencies, &m_dependencies}) {
+      if (const auto it = deps->find(name); it != deps->end()) {
+        for (const auto dep : it->second) {
+          if (std::find(ret.begin(), ret.end(), dep) == ret.end()) {
+            ret.push_back(dep);
+          }
+        }
       }
-      svc->ready(true);
     }
-
-    // Validate all services in case we encountered issues so we get useful error
-    // reporting
-    validate();
-
-    // Label initialization as complete
-    m_init = true;
+    return ret;
   }
+
+  // Initialize all services, following the ordering rules described at the top of this
+  // file. With nthreads > 1, services whose dependencies are satisfied are initialized
+  // concurrently on a pool of nthreads threads.
+  // Initialization stops at the first failure, and is finalized by validating that all
+  // is well: missing properties and uninitialized services are reported, along with the
+  // reason of the failure.
+  // Throws if dependencies are unknown or circular, or if a service fails to initialize.
+  void init(const size_t nthreads = 1);
   // Single service init (meant to be called for stragglers after general init)
   template <class Svc> void initSingle() {
     std::string_view name = Svc::kName;
@@ -154,16 +189,17 @@ public:
       if (!svc->ready()) {
         not_initialized.push_back(name);
       }
-      std::string err = "";
-      if (missing_props.size() > 0) {
-        err += fmt::format("Encountered missing service properties: {}\n", missing_props);
-      }
-      if (not_initialized.size() > 0) {
-        err += fmt::format("Encountered uninitialized services: {}\n", not_initialized);
-      }
-      if (err.size() > 0) {
-        throw ServiceError(fmt::format("Error initializing all services:\n{}", err));
-      }
+    }
+    // report the problems of all services at once
+    std::string err = "";
+    if (missing_props.size() > 0) {
+      err += fmt::format("Encountered missing service properties: {}\n", missing_props);
+    }
+    if (not_initialized.size() > 0) {
+      err += fmt::format("Encountered uninitialized services: {}\n", not_initialized);
+    }
+    if (err.size() > 0) {
+      throw ServiceError(fmt::format("Error initializing all services:\n{}", err));
     }
   }
   const auto& services() const { return m_services; }
@@ -179,6 +215,9 @@ public:
 private:
   ServiceSvc() : NameMixin{"ServiceSvc", "Special service that keeps track of all services"} {}
 
+  // Initialize a single service, returns the reason of a failure (empty on success)
+  std::string initService(std::string_view name);
+
 public:
   ServiceSvc(const ServiceSvc&) = delete;
   void operator=(const ServiceSvc&) = delete;
@@ -187,7 +226,11 @@ private:
   std::vector<std::string_view> m_keys;                // Ordered list of service keys
   std::map<std::string_view, ServiceBase*> m_services; // Map of services for easier lookup
   std::map<std::string_view, std::function<void()>> m_initializers; // Init calls
-  bool m_init = false; // did we initialize the services already?
+  std::map<std::string_view, std::vector<std::string_view>> m_dependencies; // Init order
+  std::map<std::string_view, std::vector<std::string_view>> m_implicit_dependencies;
+  bool m_init         = false; // did we initialize the services already?
+  bool m_initializing = false; // is init() running? (guarded by m_mutex)
+  std::mutex m_mutex;          // guards registration against a running init()
 };
 
 // Thread-safe lazy-evaluated minimal service system
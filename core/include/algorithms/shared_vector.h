@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Immutable, reference-counted and deduplicated vector storage, meant for large
+// properties (e.g. calibration or lookup tables) that would otherwise be deep-copied
+// into every algorithm instance and every PropertyValue.
+//
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace algorithms {
+
+namespace detail {
+  // Global store that hands out a single shared copy for vectors with identical content.
+  // Entries are only referenced weakly, so tables are freed once no longer in use.
+  template <class T> class SharedVectorStore {
+  public:
+    using data_type = std::shared_ptr<const std::vector<T>>;
+
+    static SharedVectorStore& instance() {
+      // This is guaranteed to be thread-safe from C++11 onwards.
+      static SharedVectorStore store;
+      return store;
+    }
+
+    data_type intern(std::vector<T>&& values) {
+      const size_t h = hash(values);
+      std::lock_guard<std::mutex> lock{m_mutex};
+      auto [begin, end] = m_store.equal_range(h);
+      for (auto it = begin; it != end;) {
+        if (auto data = it->second.lock()) {
+          if (*data == values) {
+            return data;
+          }
+          ++it;
+        } else {
+          // drop expired entries on the way
+          it = m_store.erase(it);
+        }
+      }
+      auto data = std::make_shared<const std::vector<T>>(std::move(values));
+      m_store.emplace(h, data);
+      return data;
+    }
+    // Shared empty vector, used for default-constructed instances
+    const data_type& empty() const { return m_empty; }
+
+  private:
+    SharedVectorStore() = default;
+
+    static size_t hash(const std::vector<T>& values) {
+      // FNV-1a over the raw bytes (only arithmetic types are supported)
+      static_assert(std::is_arithmetic_v<T>);
+      uint64_t h = 0xcbf29ce484222325ULL;
+      for (const auto& v : values) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &v, sizeof(T));
+        for (const auto b : bytes) {
+          h ^= b;
+          h *= 0x100000001b3ULL;
+        }
+      }
+      return h;
+    }
+
+    std::unordered_multimap<size_t, std::weak_ptr<const std::vector<T>>> m_store;
+    const data_type m_empty = std::make_shared<const std::vector<T>>();
+    std::mutex m_mutex;
+  };
+} // namespace detail
+
+// Read-only view on a shared, deduplicated vector. Copies only increment the reference
+// count, so it can be handed out by Property::value() and Property::get() for free.
+template <class T> class SharedVector {
+public:
+  using value_type     = T;
+  using const_iterator = typename std::vector<T>::const_iterator;
+  using iterator       = const_iterator;
+
+  SharedVector() : m_data{detail::SharedVectorStore<T>::instance().empty()} {}
+  SharedVector(std::vector<T> values)
+      : m_data{detail::SharedVectorStore<T>::instance().intern(std::move(values))} {}
+  SharedVector(std::initializer_list<T> values) : SharedVector(std::vector<T>(values)) {}
+
+  const std::vector<T>& vector() const { return *m_data; }
+  operator const std::vector<T>&() const { return *m_data; }
+  std::span<const T> span() const { return {m_data->data(), m_data->size()}; }
+
+  const T* data() const { return m_data->data(); }
+  size_t size() const { return m_data->size(); }
+  bool empty() const { return m_data->empty(); }
+  const T& operator[](const size_t i) const { return (*m_data)[i]; }
+  const_iterator begin() const { return m_data->begin(); }
+  const_iterator end() const { return m_data->end(); }
+
+  // Number of SharedVectors (and properties) sharing the same storage
+  long use_count() const { return m_data.use_count(); }
+
+  bool operator==(const SharedVector& rhs) const {
+    return m_data == rhs.m_data || *m_data == *rhs.m_data;
+  }
+
+private:
+  std::shared_ptr<const std::vector<T>> m_data;
+};
+
+template <class T> struct is_shared_vector : std::false_type {};
+template <class T> struct is_shared_vector<SharedVector<T>> : std::true_type {};
+template <class T> constexpr bool is_shared_vector_v = is_shared_vector<T>::value;
+
+} // namespace algorithms
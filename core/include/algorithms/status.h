@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Exception-free result of a processing step, for recoverable per-event conditions
+// (e.g. a noisy detector region) that would otherwise be raised thousands of times per
+// second. Creating and returning a successful Status never allocates.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+class Status {
+public:
+  enum class Code : uint8_t {
+    kSuccess = 0,
+    kSkip,  // the event should be skipped (e.g. flagged as bad), not an error
+    kError, // processing failed
+  };
+
+  Status() = default;
+  static Status skip(std::string_view reason) { return {Code::kSkip, reason}; }
+  static Status error(std::string_view msg) { return {Code::kError, msg}; }
+
+  bool ok() const { return m_code == Code::kSuccess; }
+  explicit operator bool() const { return ok(); }
+  Code code() const { return m_code; }
+  const std::string& message() const { return m_message; }
+
+  // Convert an error into an exception, for callers that prefer to raise
+  void check(std::string_view type = "algorithms::Error") const {
+    if (m_code == Code::kError) {
+      throw Error(m_message, type);
+    }
+  }
+
+private:
+  Status(const Code code, std::string_view msg) : m_code{code}, m_message{msg} {}
+
+  Code m_code = Code::kSuccess;
+  std::string m_message;
+};
+
+} // namespace algorithms
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Execution timeline: records begin/end spans of algorithm and service execution on all
+// threads, and writes them as a Chrome trace JSON file (viewable in chrome://tracing or
+// the Perfetto UI), to spot thread stalls, load imbalance and serialization points that
+// aggregate timings hide.
+//
+// Algorithm::execute() records a span for each event. Use the RAII TraceSpan to record
+// other spans, spans can be nested:
+//
+//   {
+//     auto span = algo.traceSpan();
+//     algo.prepare();
+//   }
+//
+// Service and algorithm init() are traced automatically. Tracing is off by default, and
+// enabled with Tracer::instance().enable(), otherwise spans do not read the clock. Each
+// thread appends to its own buffer without locking; write() is meant to be called at the
+// end of the job, spans that are still open are not included.
+//
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace algorithms {
+
+class Tracer {
+public:
+  // Completed span, names and categories are interned
+  struct Event {
+    uint32_t name;
+    uint32_t category;
+    int64_t begin_ns; // since the creation of the tracer
+    int64_t end_ns;
+  };
+
+  static Tracer& instance() {
+    // Never destroyed, as threads that outlive static destruction may still record spans
+    static Tracer* tracer = new Tracer;
+    return *tracer;
+  }
+
+  void enable(const bool value = true) { m_enabled.store(value, std::memory_order_relaxed); }
+  bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  // Stable identifier of a name or category, hot code should look it up once
+  uint32_t intern(std::string_view name);
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - m_epoch)
+        .count();
+  }
+  // Append a completed span to the buffer of the calling thread (lock-free)
+  void record(const Event& event);
+
+  // Number of recorded spans over all threads
+  size_t size() const;
+  // Write all completed spans as a Chrome trace JSON file
+  void write(const std::string& path) const;
+
+private:
+  // Per-thread buffer, a list of fixed-size chunks that are never moved, so it can be
+  // read while the owning thread keeps appending
+  struct Chunk {
+    static constexpr size_t kSize = 4096;
+
+    std::array<Event, kSize> events;
+    std::atomic<size_t> size{0};
+    std::atomic<Chunk*> next{nullptr};
+  };
+  struct ThreadBuffer {
+    explicit ThreadBuffer(const uint32_t i) : id{i}, head{std::make_unique<Chunk>()} {}
+
+    const uint32_t id;
+    const std::unique_ptr<Chunk> head;
+    Chunk* tail = head.get();
+    // chunks after the head, owned here and linked through Chunk::next
+    std::vector<std::unique_ptr<Chunk>> chunks;
+  };
+
+  Tracer() = default;
+  ThreadBuffer& buffer();
+
+  const std::chrono::steady_clock::time_point m_epoch = std::chrono::steady_clock::now();
+  std::atomic<bool> m_enabled{false};
+  std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+  std::map<std::string, uint32_t, std::less<>> m_ids;
+  std::vector<std::string> m_names;
+  mutable std::mutex m_mutex;
+
+public:
+  Tracer(const Tracer&) = delete;
+  void operator=(const Tracer&) = delete;
+};
+
+// Records the duration of its own lifetime with the Tracer, if tracing is enabled
+class TraceSpan {
+public:
+  TraceSpan(const uint32_t category, const uint32_t name) {
+    auto& tracer = Tracer::instance();
+    if (tracer.enabled()) {
+      m_event  = {name, category, tracer.now(), 0};
+      m_active = true;
+    }
+  }
+  TraceSpan(std::string_view category, std::string_view name)
+      : TraceSpan{Tracer::instance().intern(category), Tracer::instance().intern(name)} {}
+  ~TraceSpan() {
+    if (m_active) {
+      auto& tracer   = Tracer::instance();
+      m_event.end_ns = tracer.now();
+      tracer.record(m_event);
+    }
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  void operator=(const TraceSpan&) = delete;
+
+private:
+  Tracer::Event m_event;
+  bool m_active = false;
+};
+
+} // namespace algorithms
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the algorithm service
+//
+#include <algorithms/algorithm.h>
+
+#include <dlfcn.h>
+#include <fstream>
+
+namespace algorithms {
+
+namespace {
+  // Escape a field of the tab-separated schema file
+  std::string escape(std::string_view field) {
+    std::string ret;
+    ret.reserve(field.size());
+    for (const char c : field) {
+      switch (c) {
+      case '\\':
+        ret += "\\\\";
+        break;
+      case '\t':
+        ret += "\\t";
+        break;
+      case '\n':
+        ret += "\\n";
+        break;
+      case '\r':
+        ret += "\\r";
+        break;
+      default:
+        ret += c;
+      }
+    }
+    return ret;
+  }
+} // namespace
+
+void AlgorithmSvc::init() {
+  for (const auto& path : m_manifests) {
+    readManifest(path);
+  }
+  m_factories.freeze();
+  debug() << "Registered " << m_factories.size() << " algorithm factories" << endmsg;
+  if (!m_check_schemas) {
+    return;
+  }
+  // plugin algorithms are checked when their library is loaded
+  m_factories.forEach([&](std::string_view, std::string_view name, const FactoryEntry& e) {
+    const auto factory = e.factory.load(std::memory_order_relaxed);
+    const auto schema  = e.schema.load(std::memory_order_relaxed);
+    if (factory && schema) {
+      checkSchema(name, factory, schema);
+    }
+  });
+}
+
+AlgorithmSvc::factory_type AlgorithmSvc::load(const FactoryEntry& entry,
+                                              std::string_view name) const {
+  // only load each library once, even if requested by multiple threads at the same time
+  std::lock_guard<std::mutex> lock{m_load_mutex};
+  auto factory = entry.factory.load(std::memory_order_acquire);
+  if (factory) {
+    return factory;
+  }
+  info() << fmt::format("Loading plugin library {} for algorithm {}", entry.library, name)
+         << endmsg;
+  // The library is never closed, as the factories need to remain valid. Loading will
+  // register all algorithms in the library through add()
+  if (!dlopen(entry.library.c_str(), RTLD_NOW | RTLD_GLOBAL)) {
+    raise(fmt::format("Failed to load plugin library {}: {}", entry.library, dlerror()));
+  }
+  factory = entry.factory.load(std::memory_order_acquire);
+  if (!factory) {
+    raise(fmt::format("Plugin library {} did not register algorithm {}", entry.library, name));
+  }
+  if (const auto schema = entry.schema.load(std::memory_order_relaxed);
+      schema && m_check_schemas) {
+    checkSchema(name, factory, schema);
+  }
+  return factory;
+}
+
+void AlgorithmSvc::checkSchema(std::string_view name, factory_type factory,
+                               schema_type schema) const {
+  const auto algo        = factory();
+  const auto& properties = algo->getProperties();
+  std::vector<std::string> errors;
+  for (const auto& info : schema().properties()) {
+    const auto it = properties.find(info.name);
+    if (it == properties.end()) {
+      errors.push_back(fmt::format("property {} does not exist", info.name));
+      continue;
+    }
+    const auto& prop = it->second;
+    if (prop.typeIndex() != info.type) {
+      errors.push_back(fmt::format("property {} is of type {}, not {}", info.name,
+                                   kPropertyTypeNames[prop.typeIndex()], info.typeName()));
+      continue;
+    }
+    if (prop.description() != info.description) {
+      errors.push_back(fmt::format("property {} has a different description", info.name));
+    }
+    if (prop.hasValue() != info.defaultValue.has_value()) {
+      errors.push_back(fmt::format("property {} {} a default value", info.name,
+                                   prop.hasValue() ? "has" : "does not have"));
+    } else if (prop.hasValue() && prop.get() != *info.defaultValue) {
+      errors.push_back(fmt::format("property {} has a different default value", info.name));
+    }
+  }
+  for (const auto& [pname, prop] : properties) {
+    if (!schema().find(pname)) {
+      errors.push_back(fmt::format("property {} is missing from the schema", pname));
+    }
+  }
+  if (!errors.empty()) {
+    raise<PropertyError>(fmt::format("Property schema of algorithm {} does not match its "
+                                     "properties: {}",
+                                     name, fmt::join(errors, ", ")));
+  }
+}
+
+void AlgorithmSvc::writeSchemas(const std::string& path) const {
+  ensureReady();
+  std::ofstream out{path};
+  if (!out) {
+    raise(fmt::format("Failed to open {} to write the algorithm property schemas", path));
+  }
+  // Format: one line per algorithm, followed by one line per property
+  //   algorithm <TAB> <name> <TAB> <algorithm_type>
+  //   property <TAB> <name> <TAB> <type> <TAB> <default or empty> <TAB> <description>
+  // Backslashes, tabs and line breaks in the fields are escaped as \\, \t, \n and \r
+  m_factories.forEach([&](std::string_view type, std::string_view name, const FactoryEntry& e) {
+    const auto schema = e.schema.load(std::memory_order_relaxed);
+    if (!schema) {
+      return;
+    }
+    out << fmt::format("algorithm\t{}\t{}\n", escape(name), escape(type));
+    for (const auto& prop : schema().properties()) {
+      const std::string def =
+          prop.defaultValue
+              ? std::visit([](const auto& v) { return fmt::format("{}", v); }, *prop.defaultValue)
+              : "";
+      out << fmt::format("property\t{}\t{}\t{}\t{}\n", escape(prop.name), prop.typeName(),
+                         escape(def), escape(prop.description));
+    }
+  });
+}
+
+void AlgorithmSvc::readManifest(const std::string& path) {
+  std::ifstream manifest{path};
+  if (!manifest) {
+    raise(fmt::format("Failed to open algorithm manifest {}", path));
+  }
+  size_t count = 0;
+  std::string line;
+  for (size_t lineno = 1; std::getline(manifest, line); ++lineno) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    const auto first  = line.find(';');
+    const auto second = line.rfind(';');
+    if (first == std::string::npos || first == second) {
+      raise(fmt::format("Malformed entry in algorithm manifest {}:{}: '{}'", path, lineno, line));
+    }
+    const std::string_view view{line};
+    const auto name    = view.substr(0, first);
+    const auto type    = view.substr(first + 1, second - first - 1);
+    const auto library = view.substr(second + 1);
+    // algorithms that are already linked take precedence over the plugin library
+    if (m_factories.add(type, name, {nullptr, nullptr, library})) {
+      ++count;
+    }
+  }
+  debug() << fmt::format("Indexed {} plugin algorithms from {}", count, path) << endmsg;
+}
+
+} // namespace algorithms
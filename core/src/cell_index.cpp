@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the cell spatial index
+//
+#include <algorithms/cell_index.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fmt/format.h>
+#include <limits>
+#include <numeric>
+
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+namespace {
+  // Aim for a few cells per grid bin
+  constexpr double kCellsPerBin = 4.;
+  // Upper limit on the number of bins per axis
+  constexpr size_t kMaxBinsPerAxis = 4096;
+} // namespace
+
+template <class F>
+void CellIndex::forEachWithin(const std::array<double, 3>& p, const double radius, F&& f) const {
+  std::array<long, 3> lo;
+  std::array<long, 3> hi;
+  for (size_t d = 0; d < 3; ++d) {
+    const double first = std::floor((p[d] - radius - m_min[d]) / m_bin_size[d]);
+    const double last  = std::floor((p[d] + radius - m_min[d]) / m_bin_size[d]);
+    const long nbins   = static_cast<long>(m_nbins[d]);
+    // edge bins also hold the cells on or just beyond the grid boundary
+    lo[d] = static_cast<long>(std::clamp<double>(first, 0, nbins - 1));
+    hi[d] = static_cast<long>(std::clamp<double>(last, 0, nbins - 1));
+    if (last < 0 || first > nbins - 1) {
+      return;
+    }
+  }
+  const double r2 = radius * radius;
+  for (long ix = lo[0]; ix <= hi[0]; ++ix) {
+    for (long iy = lo[1]; iy <= hi[1]; ++iy) {
+      for (long iz = lo[2]; iz <= hi[2]; ++iz) {
+        const size_t b = (ix * m_nbins[1] + iy) * m_nbins[2] + iz;
+        for (uint32_t k = m_bin_offsets[b]; k < m_bin_offsets[b + 1]; ++k) {
+          const uint32_t i = m_bin_cells[k];
+          const double dx  = m_pos[0][i] - p[0];
+          const double dy  = m_pos[1][i] - p[1];
+          const double dz  = m_pos[2][i] - p[2];
+          if (dx * dx + dy * dy + dz * dz <= r2) {
+            f(i);
+          }
+        }
+      }
+    }
+  }
+}
+
+CellIndex::CellIndex(gsl::span<const dd4hep::CellID> cells,
+                     gsl::span<const dd4hep::Position> positions, double neighbor_distance) {
+  if (cells.size() != positions.size()) {
+    throw Error(fmt::format("Cannot index {} cells with {} positions", cells.size(),
+                            positions.size()),
+                "algorithms::CellIndex");
+  }
+  if (cells.size() > std::numeric_limits<uint32_t>::max()) {
+    throw Error(fmt::format("Too many cells to index ({})", cells.size()), "algorithms::CellIndex");
+  }
+
+  // sort by cellID (and drop duplicates) for the cellID lookups
+  std::vector<size_t> order(cells.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cells[a] < cells[b]; });
+  order.erase(std::unique(order.begin(), order.end(),
+                          [&](size_t a, size_t b) { return cells[a] == cells[b]; }),
+              order.end());
+  const size_t n = order.size();
+  m_ids.resize(n);
+  for (auto& p : m_pos) {
+    p.resize(n);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    m_ids[i]    = cells[order[i]];
+    m_pos[0][i] = positions[order[i]].x();
+    m_pos[1][i] = positions[order[i]].y();
+    m_pos[2][i] = positions[order[i]].z();
+  }
+  if (n == 0) {
+    m_bin_offsets      = {0, 0};
+    m_neighbor_offsets = {0};
+    return;
+  }
+
+  // Grid: bin size from the cell density, only over the axes the cells extend along
+  // (e.g. a single layer is flat in one direction)
+  std::array<double, 3> extent{};
+  double volume = 1.;
+  int ndim      = 0;
+  for (size_t d = 0; d < 3; ++d) {
+    const auto [lo, hi] = std::minmax_element(m_pos[d].begin(), m_pos[d].end());
+    m_min[d]            = *lo;
+    extent[d]           = *hi - *lo;
+    if (extent[d] > 0) {
+      volume *= extent[d];
+      ++ndim;
+    }
+  }
+  const double bin_size = ndim ? std::pow(volume * kCellsPerBin / n, 1. / ndim) : 1.;
+  for (size_t d = 0; d < 3; ++d) {
+    m_nbins[d] = extent[d] > 0 ? std::clamp<size_t>(std::ceil(extent[d] / bin_size), 1,
+                                                    kMaxBinsPerAxis)
+                               : 1;
+    m_bin_size[d] = extent[d] > 0 ? extent[d] / m_nbins[d] : 1.;
+  }
+
+  // Fill the bins (counting sort)
+  const size_t nbins = m_nbins[0] * m_nbins[1] * m_nbins[2];
+  std::vector<size_t> bins(n);
+  m_bin_offsets.assign(nbins + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    bins[i] = bin({m_pos[0][i], m_pos[1][i], m_pos[2][i]});
+    ++m_bin_offsets[bins[i] + 1];
+  }
+  std::partial_sum(m_bin_offsets.begin(), m_bin_offsets.end(), m_bin_offsets.begin());
+  m_bin_cells.resize(n);
+  std::vector<uint32_t> fill(m_bin_offsets.begin(), m_bin_offsets.end() - 1);
+  for (size_t i = 0; i < n; ++i) {
+    m_bin_cells[fill[bins[i]]++] = static_cast<uint32_t>(i);
+  }
+
+  // Default neighbor distance from the typical cell spacing
+  if (neighbor_distance <= 0.) {
+    const double diagonal = std::hypot(extent[0], extent[1], extent[2]);
+    std::vector<double> closest;
+    closest.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      const std::array<double, 3> p{m_pos[0][i], m_pos[1][i], m_pos[2][i]};
+      double best = std::numeric_limits<double>::infinity();
+      // search the surrounding bins first, widening if they hold no other cell
+      for (double r = bin_size; std::isinf(best) && r < 2 * (diagonal + bin_size); r *= 2) {
+        forEachWithin(p, r, [&](const size_t j) {
+          if (j != i) {
+            best = std::min(best, std::hypot(m_pos[0][j] - p[0], m_pos[1][j] - p[1],
+                                             m_pos[2][j] - p[2]));
+          }
+        });
+      }
+      if (!std::isinf(best)) {
+        closest.push_back(best);
+      }
+    }
+    if (!closest.empty()) {
+      std::nth_element(closest.begin(), closest.begin() + closest.size() / 2, closest.end());
+      neighbor_distance = 1.5 * closest[closest.size() / 2];
+    }
+  }
+  m_neighbor_distance = neighbor_distance;
+
+  // Neighbor table
+  m_neighbor_offsets.reserve(n + 1);
+  m_neighbor_offsets.push_back(0);
+  std::vector<size_t> found;
+  for (size_t i = 0; i < n; ++i) {
+    found.clear();
+    forEachWithin({m_pos[0][i], m_pos[1][i], m_pos[2][i]}, m_neighbor_distance,
+                  [&](const size_t j) {
+                    if (j != i) {
+                      found.push_back(j);
+                    }
+                  });
+    // indices are sorted by cellID, so this keeps the neighbors sorted by cellID
+    std::sort(found.begin(), found.end());
+    for (const auto j : found) {
+      m_neighbor_ids.push_back(m_ids[j]);
+    }
+    m_neighbor_offsets.push_back(static_cast<uint32_t>(m_neighbor_ids.size()));
+  }
+}
+
+std::optional<dd4hep::Position> CellIndex::position(const dd4hep::CellID id) const {
+  const auto i = index(id);
+  if (!i) {
+    return std::nullopt;
+  }
+  return dd4hep::Position(m_pos[0][*i], m_pos[1][*i], m_pos[2][*i]);
+}
+
+gsl::span<const dd4hep::CellID> CellIndex::neighbors(const dd4hep::CellID id) const {
+  const auto i = index(id);
+  if (!i) {
+    return {};
+  }
+  return {m_neighbor_ids.data() + m_neighbor_offsets[*i],
+          m_neighbor_offsets[*i + 1] - m_neighbor_offsets[*i]};
+}
+
+void CellIndex::within(const dd4hep::Position& point, const double radius,
+                       std::vector<dd4hep::CellID>& out) const {
+  forEachWithin({point.x(), point.y(), point.z()}, radius,
+                [&](const size_t i) { out.push_back(m_ids[i]); });
+}
+
+std::optional<dd4hep::CellID> CellIndex::nearest(const dd4hep::Position& point) const {
+  if (m_ids.empty()) {
+    return std::nullopt;
+  }
+  const std::array<double, 3> p{point.x(), point.y(), point.z()};
+  // Widen the search radius until it holds a cell. All cells within the radius are checked
+  // by distance, so the closest of them is the nearest cell overall.
+  double reach = 0.;
+  for (size_t d = 0; d < 3; ++d) {
+    const double lo = m_min[d] - p[d];
+    const double hi = m_min[d] + m_nbins[d] * m_bin_size[d] - p[d];
+    reach += std::max(lo * lo, hi * hi);
+  }
+  reach = std::sqrt(reach);
+  for (double r = std::max({m_bin_size[0], m_bin_size[1], m_bin_size[2]});; r *= 2) {
+    size_t best    = m_ids.size();
+    double best_d2 = std::numeric_limits<double>::infinity();
+    forEachWithin(p, r, [&](const size_t i) {
+      const double dx = m_pos[0][i] - p[0];
+      const double dy = m_pos[1][i] - p[1];
+      const double dz = m_pos[2][i] - p[2];
+      const double d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 <= best_d2) {
+        best    = i;
+        best_d2 = d2;
+      }
+    });
+    if (best != m_ids.size()) {
+      return m_ids[best];
+    }
+    if (r > reach) {
+      return std::nullopt;
+    }
+  }
+}
+
+std::optional<size_t> CellIndex::index(const dd4hep::CellID id) const {
+  const auto it = std::lower_bound(m_ids.begin(), m_ids.end(), id);
+  if (it == m_ids.end() || *it != id) {
+    return std::nullopt;
+  }
+  return it - m_ids.begin();
+}
+
+size_t CellIndex::bin(const std::array<double, 3>& p) const {
+  size_t b = 0;
+  for (size_t d = 0; d < 3; ++d) {
+    const auto i = static_cast<long>(std::floor((p[d] - m_min[d]) / m_bin_size[d]));
+    b = b * m_nbins[d] + std::clamp<long>(i, 0, m_nbins[d] - 1);
+  }
+  return b;
+}
+
+} // namespace algorithms
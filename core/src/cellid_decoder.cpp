@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the cellID decoder
+//
+#include <algorithms/cellid_decoder.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <fmt/format.h>
+
+namespace algorithms {
+
+namespace {
+  std::string_view trim(std::string_view s) {
+    const auto first = s.find_first_not_of(" \t\n");
+    if (first == std::string_view::npos) {
+      return {};
+    }
+    return s.substr(first, s.find_last_not_of(" \t\n") - first + 1);
+  }
+  int toInt(std::string_view s, std::string_view description) {
+    s = trim(s);
+
+    int value            = 0;
+    const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (ec != std::errc() || end != s.data() + s.size()) {
+      throw CellIDDecoderError(
+          fmt::format("Invalid number '{}' in cellID description '{}'", s, description));
+    }
+    return value;
+  }
+} // namespace
+
+CellIDDecoder::CellIDDecoder(std::string_view description) : m_description{description} {
+  unsigned next = 0; // fields without explicit offset follow the previous one
+  uint64_t used = 0;
+  size_t start  = 0;
+  while (start <= description.size()) {
+    const auto end = std::min(description.find(',', start), description.size());
+    const auto tok = trim(description.substr(start, end - start));
+    start          = end + 1;
+    if (tok.empty()) {
+      continue;
+    }
+    // <name>:<width> or <name>:<offset>:<width>
+    const auto c1 = tok.find(':');
+    const auto c2 = c1 == std::string_view::npos ? c1 : tok.find(':', c1 + 1);
+    if (c1 == std::string_view::npos) {
+      throw CellIDDecoderError(
+          fmt::format("Invalid field '{}' in cellID description '{}'", tok, description));
+    }
+    const auto name = trim(tok.substr(0, c1));
+    int offset      = next;
+    int width       = 0;
+    if (c2 == std::string_view::npos) {
+      width = toInt(tok.substr(c1 + 1), description);
+    } else {
+      offset = toInt(tok.substr(c1 + 1, c2 - c1 - 1), description);
+      width  = toInt(tok.substr(c2 + 1), description);
+    }
+    Field field;
+    field.offset    = offset;
+    field.width     = std::abs(width);
+    field.is_signed = width < 0;
+    if (name.empty() || offset < 0 || field.width == 0 || field.offset + field.width > 64) {
+      throw CellIDDecoderError(
+          fmt::format("Invalid field '{}' in cellID description '{}'", tok, description));
+    }
+    if (used & field.mask()) {
+      throw CellIDDecoderError(
+          fmt::format("Field {} overlaps with other fields in '{}'", name, description));
+    }
+    for (const auto& n : m_names) {
+      if (n == name) {
+        throw CellIDDecoderError(
+            fmt::format("Duplicate field {} in cellID description '{}'", name, description));
+      }
+    }
+    used |= field.mask();
+    next = field.offset + field.width;
+    m_fields.push_back(field);
+    m_names.emplace_back(name);
+  }
+}
+
+size_t CellIDDecoder::index(std::string_view name) const {
+  for (size_t i = 0; i < m_names.size(); ++i) {
+    if (m_names[i] == name) {
+      return i;
+    }
+  }
+  throw CellIDDecoderError(
+      fmt::format("Unknown field {} in cellID description '{}'", name, m_description));
+}
+
+void CellIDDecoder::decode(gsl::span<const uint64_t> ids, const size_t i,
+                           gsl::span<int64_t> out) const {
+  if (out.size() < ids.size()) {
+    throw CellIDDecoderError(
+        fmt::format("Cannot decode {} cellIDs into {} values", ids.size(), out.size()));
+  }
+  const Field field = m_fields.at(i);
+  // the sign handling is loop-invariant, so both loops are plain shifts
+  const unsigned up   = 64 - field.offset - field.width;
+  const unsigned down = 64 - field.width;
+  if (field.is_signed) {
+    for (size_t j = 0; j < ids.size(); ++j) {
+      out[j] = static_cast<int64_t>(ids[j] << up) >> down;
+    }
+  } else {
+    for (size_t j = 0; j < ids.size(); ++j) {
+      out[j] = static_cast<int64_t>((ids[j] << up) >> down);
+    }
+  }
+}
+
+void CellIDDecoder::decode(gsl::span<const uint64_t> ids, gsl::span<const size_t> fields,
+                           gsl::span<int64_t> out) const {
+  if (out.size() < ids.size() * fields.size()) {
+    throw CellIDDecoderError(fmt::format("Cannot decode {} fields of {} cellIDs into {} values",
+                                         fields.size(), ids.size(), out.size()));
+  }
+  for (size_t k = 0; k < fields.size(); ++k) {
+    decode(ids, fields[k], out.subspan(k * ids.size(), ids.size()));
+  }
+}
+
+std::vector<std::vector<int64_t>> CellIDDecoder::decode(gsl::span<const uint64_t> ids) const {
+  std::vector<std::vector<int64_t>> ret(m_fields.size(), std::vector<int64_t>(ids.size()));
+  for (size_t i = 0; i < m_fields.size(); ++i) {
+    decode(ids, i, ret[i]);
+  }
+  return ret;
+}
+
+} // namespace algorithms
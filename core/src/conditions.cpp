@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the conditions service
+//
+#include <algorithms/conditions.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <algorithms/memory.h>
+#include <algorithms/trace.h>
+
+namespace algorithms {
+
+namespace {
+  template <class T> bool parse(std::string_view token, T& value) {
+    const auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return ec == std::errc() && end == token.data() + token.size();
+  }
+
+  // Empty and whitespace-only lines, and comments (possibly indented) are skipped
+  bool blankOrComment(std::string_view line) {
+    const auto first = line.find_first_not_of(" \t\r\f\v");
+    return first == std::string_view::npos || line[first] == '#';
+  }
+} // namespace
+
+ConditionsPayload ConditionsPayload::read(const std::string& path) {
+  std::ifstream in{path};
+  if (!in) {
+    throw ConditionsError(fmt::format("Failed to open conditions payload {}", path));
+  }
+  TableMap tables;
+  std::string line;
+  for (size_t lineno = 1; std::getline(in, line); ++lineno) {
+    if (blankOrComment(line)) {
+      continue;
+    }
+    std::istringstream tokens{line};
+    std::string name;
+    tokens >> name;
+    std::vector<double> values;
+    for (std::string token; tokens >> token;) {
+      double v;
+      if (!parse(token, v)) {
+        throw ConditionsError(
+            fmt::format("Invalid value '{}' in conditions payload {}:{}", token, path, lineno));
+      }
+      values.push_back(v);
+    }
+    if (values.empty()) {
+      throw ConditionsError(
+          fmt::format("Missing values in conditions payload {}:{}: '{}'", path, lineno, line));
+    }
+    if (!tables.emplace(name, std::move(values)).second) {
+      throw ConditionsError(
+          fmt::format("Duplicate table {} in conditions payload {}:{}", name, path, lineno));
+    }
+  }
+  return ConditionsPayload{std::move(tables)};
+}
+
+const std::vector<double>& ConditionsPayload::table(std::string_view name) const {
+  const auto it = m_tables.find(name);
+  if (it == m_tables.end()) {
+    throw ConditionsError(fmt::format("No table {} in conditions payload", name));
+  }
+  return it->second;
+}
+
+double ConditionsPayload::value(std::string_view name) const {
+  const auto& t = table(name);
+  if (t.size() != 1) {
+    throw ConditionsError(
+        fmt::format("Table {} in conditions payload has {} values, expected 1", name, t.size()));
+  }
+  return t[0];
+}
+
+const ConditionsPayload& Condition::at(const uint64_t run) const {
+  // fast path: same interval as the previous lookup (e.g. the same run)
+  const size_t last = m_last.load(std::memory_order_relaxed);
+  if (last < m_intervals.size() && m_intervals[last]->iov.contains(run)) {
+    if (const auto* payload = m_intervals[last]->loaded.load(std::memory_order_acquire)) {
+      return *payload;
+    }
+  }
+  const size_t index  = find(run);
+  const auto& payload = load(index);
+  m_last.store(index, std::memory_order_relaxed);
+  return payload;
+}
+
+size_t Condition::find(const uint64_t run) const {
+  // first interval that ends at or after the run
+  const auto it = std::lower_bound(
+      m_intervals.begin(), m_intervals.end(), run,
+      [](const std::unique_ptr<const Interval>& i, const uint64_t r) { return i->iov.last < r; });
+  if (it == m_intervals.end() || !(*it)->iov.contains(run)) {
+    throw ConditionsError(fmt::format("No interval of condition {} contains run {}", m_name, run));
+  }
+  return it - m_intervals.begin();
+}
+
+const ConditionsPayload& Condition::load(const size_t index, const bool prefetch_next) const {
+  const auto& interval = *m_intervals[index];
+  if (const auto* payload = interval.loaded.load(std::memory_order_acquire)) {
+    return *payload;
+  }
+  // concurrent first accesses wait for a single load, a failed load is retried next time
+  bool first = false;
+  std::call_once(interval.once, [&] {
+    const auto& svc = ConditionsSvc::instance();
+    const std::string name =
+        fmt::format("{} [{}, {}]", m_name, interval.iov.first,
+                    interval.iov.last == IOV::kOpen ? "*" : std::to_string(interval.iov.last));
+    svc.debug("Loading conditions payload {} from {}", name, interval.path);
+    // not an init() step, loads usually happen during the event loop
+    TraceSpan span{"conditions", name};
+    MemoryScope memory{svc.name()};
+    interval.payload = std::make_unique<const ConditionsPayload>(
+        ConditionsPayload::read(interval.path));
+    interval.loaded.store(interval.payload.get(), std::memory_order_release);
+    first = true;
+  });
+  if (first && prefetch_next && index + 1 < m_intervals.size()) {
+    ConditionsSvc::instance().prefetch(*this, index + 1);
+  }
+  return *interval.payload;
+}
+
+void ConditionsSvc::init() {
+  for (const auto& path : m_index_files) {
+    readIndex(path);
+  }
+  for (auto& [name, condition] : m_conditions) {
+    auto& intervals = condition->m_intervals;
+    std::sort(intervals.begin(), intervals.end(),
+              [](const auto& a, const auto& b) { return a->iov.first < b->iov.first; });
+    for (size_t i = 1; i < intervals.size(); ++i) {
+      if (intervals[i]->iov.first <= intervals[i - 1]->iov.last) {
+        raise<ConditionsError>(fmt::format("Overlapping intervals of condition {}: {} and {}",
+                                           name, intervals[i - 1]->path, intervals[i]->path));
+      }
+    }
+  }
+  debug() << fmt::format("Indexed {} conditions", m_conditions.size()) << endmsg;
+}
+
+const Condition& ConditionsSvc::condition(std::string_view name) const {
+  const auto it = m_conditions.find(name);
+  if (it == m_conditions.end()) {
+    raise<ConditionsError>(fmt::format("No condition {} in the conditions index", name));
+  }
+  return *it->second;
+}
+
+void ConditionsSvc::preload(const uint64_t run) const {
+  for (const auto& [name, condition] : m_conditions) {
+    try {
+      condition->at(run);
+    } catch (const ConditionsError&) {
+      // conditions that are not defined for this run only raise when used
+    }
+  }
+}
+
+std::vector<std::string_view> ConditionsSvc::conditions() const {
+  std::vector<std::string_view> ret;
+  for (const auto& [name, condition] : m_conditions) {
+    ret.push_back(name);
+  }
+  return ret;
+}
+
+void ConditionsSvc::readIndex(const std::string& path) {
+  std::ifstream index{path};
+  if (!index) {
+    raise<ConditionsError>(fmt::format("Failed to open conditions index {}", path));
+  }
+  const auto dir = std::filesystem::path{path}.parent_path();
+  size_t count   = 0;
+  std::string line;
+  for (size_t lineno = 1; std::getline(index, line); ++lineno) {
+    if (blankOrComment(line)) {
+      continue;
+    }
+    std::istringstream tokens{line};
+    std::string name, first, last, payload, extra;
+    IOV iov;
+    if (!(tokens >> name >> first >> last >> payload) || tokens >> extra ||
+        !parse(first, iov.first) || (last != "*" && !parse(last, iov.last)) ||
+        iov.last < iov.first) {
+      raise<ConditionsError>(
+          fmt::format("Malformed entry in conditions index {}:{}: '{}'", path, lineno, line));
+    }
+    auto& condition = m_conditions[name];
+    if (!condition) {
+      condition = std::make_unique<Condition>(name);
+    }
+    condition->m_intervals.push_back(
+        std::make_unique<const Condition::Interval>(iov, (dir / payload).string()));
+    ++count;
+  }
+  debug() << fmt::format("Indexed {} conditions intervals from {}", count, path) << endmsg;
+}
+
+void ConditionsSvc::prefetch(const Condition& condition, const size_t index) const {
+  if (!m_prefetch) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{m_prefetch_mutex};
+  // forget about finished prefetches
+  m_prefetches.erase(std::remove_if(m_prefetches.begin(), m_prefetches.end(),
+                                    [](const std::future<void>& f) {
+                                      return f.wait_for(std::chrono::seconds(0)) ==
+                                             std::future_status::ready;
+                                    }),
+                     m_prefetches.end());
+  m_prefetches.push_back(std::async(std::launch::async, [this, &condition, index] {
+    try {
+      condition.load(index, false);
+    } catch (const std::exception& e) {
+      // the load is retried (and the error raised) when the payload is used
+      warning("Failed to prefetch conditions payload: {}", e.what());
+    }
+  }));
+}
+
+} // namespace algorithms
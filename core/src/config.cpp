@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the compiled configuration snapshot
+//
+#include <algorithms/config.h>
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include <algorithms/service.h>
+#include <algorithms/type_traits.h>
+
+namespace algorithms {
+
+namespace {
+  constexpr std::array<char, 8> kMagic{'A', 'L', 'G', 'O', 'C', 'F', 'G', '\0'};
+  constexpr uint32_t kByteOrder = 0x01020304;
+  constexpr size_t kHeaderSize  = kMagic.size() + 3 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+  // bool is stored as uint8 for a well-defined size
+  template <class T> void writeScalar(std::ostream& os, const T& v) {
+    if constexpr (std::is_same_v<T, bool>) {
+      detail::writeBinary(os, static_cast<uint8_t>(v));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      detail::writeBinaryString(os, v);
+    } else {
+      detail::writeBinary(os, v);
+    }
+  }
+  template <class T> T readScalar(detail::ByteReader& in) {
+    if constexpr (std::is_same_v<T, bool>) {
+      return in.read<uint8_t>() != 0;
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      return std::string{in.readString()};
+    } else {
+      return in.read<T>();
+    }
+  }
+
+  // Skip a scalar or the elements of a vector without decoding them, only checking bounds
+  template <class T> void skipScalars(detail::ByteReader& in, const uint32_t n) {
+    if constexpr (std::is_same_v<T, std::string>) {
+      for (uint32_t i = 0; i < n; ++i) {
+        in.readString();
+      }
+    } else {
+      in.take(n * (std::is_same_v<T, bool> ? sizeof(uint8_t) : sizeof(T)));
+    }
+  }
+
+  void writeValue(std::ostream& os, const PropertyValue& value) {
+    detail::writeBinary(os, static_cast<uint8_t>(value.index()));
+    std::visit(
+        [&](const auto& v) {
+          using T = std::decay_t<decltype(v)>;
+          if constexpr (is_vector_v<T> || is_shared_vector_v<T>) {
+            detail::writeBinary(os, static_cast<uint32_t>(v.size()));
+            for (const auto& elem : v) {
+              writeScalar<typename T::value_type>(os, elem);
+            }
+          } else {
+            writeScalar(os, v);
+          }
+        },
+        value);
+  }
+
+  template <size_t I = 0> PropertyValue readValue(detail::ByteReader& in, const size_t type) {
+    if constexpr (I == std::variant_size_v<PropertyValue>) {
+      throw ConfigError(fmt::format("Invalid property type index {}", type));
+    } else {
+      if (type != I) {
+        return readValue<I + 1>(in, type);
+      }
+      using T = std::variant_alternative_t<I, PropertyValue>;
+      if constexpr (is_vector_v<T> || is_shared_vector_v<T>) {
+        // shared vectors are deduplicated with identical tables already in use
+        const auto n = in.read<uint32_t>();
+        std::vector<typename T::value_type> v;
+        v.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) {
+          v.push_back(readScalar<typename T::value_type>(in));
+        }
+        return T{std::move(v)};
+      } else {
+        return readScalar<T>(in);
+      }
+    }
+  }
+
+  // Skip a value of a given type index, validating only its structure
+  template <size_t I = 0> void skipValue(detail::ByteReader& in, const size_t type) {
+    if constexpr (I == std::variant_size_v<PropertyValue>) {
+      throw ConfigError(fmt::format("Invalid property type index {}", type));
+    } else {
+      if (type != I) {
+        skipValue<I + 1>(in, type);
+        return;
+      }
+      using T = std::variant_alternative_t<I, PropertyValue>;
+      if constexpr (is_vector_v<T> || is_shared_vector_v<T>) {
+        skipScalars<typename T::value_type>(in, in.read<uint32_t>());
+      } else {
+        skipScalars<T>(in, 1);
+      }
+    }
+  }
+} // namespace
+
+void ConfigSnapshot::write(const std::string& path, const ConfigType& config) {
+  std::ostringstream payload;
+  for (const auto& [owner, props] : config) {
+    detail::writeBinaryString(payload, owner);
+    detail::writeBinary(payload, static_cast<uint32_t>(props.size()));
+    for (const auto& [name, value] : props) {
+      detail::writeBinaryString(payload, name);
+      writeValue(payload, value);
+    }
+  }
+  const std::string data = payload.str();
+
+  std::ofstream out{path, std::ios::binary};
+  if (!out) {
+    throw ConfigError(fmt::format("Failed to open {} to write the configuration snapshot", path));
+  }
+  out.write(kMagic.data(), kMagic.size());
+  detail::writeBinary(out, kByteOrder);
+  detail::writeBinary(out, kVersion);
+  detail::writeBinary(out, static_cast<uint32_t>(config.size()));
+  detail::writeBinary(out, static_cast<uint64_t>(data.size()));
+  detail::writeBinary(out, detail::checksum(data.data(), data.size()));
+  out.write(data.data(), data.size());
+}
+
+ConfigSnapshot::OwnerConfig ConfigSnapshot::capture(const Configurable& c) {
+  OwnerConfig config;
+  for (const auto& [name, prop] : c.getProperties()) {
+    if (prop.hasValue()) {
+      config.emplace(name, prop.get());
+    }
+  }
+  return config;
+}
+
+ConfigSnapshot::ConfigSnapshot(const std::string& path) : m_file{path} {
+  try {
+    detail::ByteReader in{m_file.data(), m_file.size()};
+    if (std::memcmp(in.take(kMagic.size()), kMagic.data(), kMagic.size()) != 0) {
+      throw ConfigError("not a configuration snapshot");
+    }
+    if (in.read<uint32_t>() != kByteOrder) {
+      throw ConfigError("snapshot was written with a different byte order");
+    }
+    if (const auto version = in.read<uint32_t>(); version != kVersion) {
+      throw ConfigError(fmt::format("unsupported version {} (expected {})", version, kVersion));
+    }
+    const auto nowners  = in.read<uint32_t>();
+    const auto size     = in.read<uint64_t>();
+    const auto expected = in.read<uint64_t>();
+    if (size != m_file.size() - kHeaderSize) {
+      throw ConfigError("inconsistent payload size");
+    }
+    if (detail::checksum(reinterpret_cast<const char*>(m_file.data()) + kHeaderSize, size) !=
+        expected) {
+      throw ConfigError("checksum mismatch");
+    }
+    // walk all records once to validate their structure and index the owners, the values
+    // are only decoded by apply()
+    for (uint32_t i = 0; i < nowners; ++i) {
+      const auto owner  = in.readString();
+      const auto nprops = in.read<uint32_t>();
+      if (!m_owners.empty() && owner <= m_owners.rbegin()->first) {
+        throw ConfigError(owner == m_owners.rbegin()->first
+                              ? fmt::format("duplicate owner {}", owner)
+                              : fmt::format("owner {} is not sorted by name", owner));
+      }
+      m_owners.emplace_hint(m_owners.end(), owner, OwnerRecord{in.position(), nprops});
+      std::string_view previous;
+      for (uint32_t j = 0; j < nprops; ++j) {
+        const auto name = in.readString();
+        if (j > 0 && name <= previous) {
+          throw ConfigError(fmt::format("duplicate or unsorted property {} of {}", name, owner));
+        }
+        previous = name;
+        skipValue(in, in.read<uint8_t>());
+      }
+    }
+    if (!in.done()) {
+      throw ConfigError("trailing data after last record");
+    }
+  } catch (const Error& e) {
+    throw ConfigError(fmt::format("Invalid configuration snapshot {}: {}", path, e.what()));
+  }
+}
+
+std::vector<std::string_view> ConfigSnapshot::owners() const {
+  std::vector<std::string_view> ret;
+  for (const auto& [owner, record] : m_owners) {
+    ret.push_back(owner);
+  }
+  return ret;
+}
+
+size_t ConfigSnapshot::apply(std::string_view owner, Configurable& c) const {
+  const auto it = m_owners.find(owner);
+  if (it == m_owners.end()) {
+    return 0;
+  }
+  detail::ByteReader in{m_file.data(), m_file.size()};
+  in.seek(it->second.offset);
+  std::vector<std::pair<std::string_view, PropertyValue>> props;
+  props.reserve(it->second.size);
+  for (uint32_t i = 0; i < it->second.size; ++i) {
+    const auto name = in.readString();
+    props.emplace_back(name, readValue(in, in.read<uint8_t>()));
+  }
+  try {
+    c.setProperties(props);
+  } catch (const PropertyError& e) {
+    throw ConfigError(fmt::format("Failed to configure {}: {}", owner, e.what()));
+  }
+  return props.size();
+}
+
+void ConfigSnapshot::applyServices() const {
+  for (const auto& [name, svc] : ServiceSvc::instance().services()) {
+    apply(name, *svc);
+  }
+}
+
+} // namespace algorithms
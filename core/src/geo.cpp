@@ -5,30 +5,425 @@
 //
 #include <algorithms/geo.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <DD4hep/Readout.h>
+#include <DD4hep/Segmentations.h>
+#include <DD4hep/VolumeManager.h>
+#include <DDSegmentation/BitFieldCoder.h>
+#include <DDSegmentation/CartesianGridXY.h>
+#include <TGeoMatrix.h>
+
+#include <algorithms/detail/mapped_file.h>
+#include <algorithms/profile.h>
+
 namespace algorithms {
 
+namespace {
+  CellIDDecoder::Field toField(const dd4hep::DDSegmentation::BitFieldElement& e) {
+    return {e.offset(), e.width(), e.isSigned()};
+  }
+
+  // Combined local --> world transform of a volume: rotation (row-major) and translation
+  struct Transform {
+    double r[9];
+    double t[3];
+
+    // Transform of the sensitive volume to the world, equivalent to
+    // VolumeManagerContext::localToWorld()
+    explicit Transform(const dd4hep::VolumeManagerContext& context) {
+      const TGeoMatrix& to_element = context.toElement();
+      const TGeoMatrix& to_world   = context.element.nominal().worldTransformation();
+      const double* re             = to_element.GetRotationMatrix();
+      const double* te             = to_element.GetTranslation();
+      const double* rw             = to_world.GetRotationMatrix();
+      const double* tw             = to_world.GetTranslation();
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          r[3 * i + j] = rw[3 * i] * re[j] + rw[3 * i + 1] * re[3 + j] + rw[3 * i + 2] * re[6 + j];
+        }
+        t[i] = rw[3 * i] * te[0] + rw[3 * i + 1] * te[1] + rw[3 * i + 2] * te[2] + tw[i];
+      }
+    }
+  };
+} // namespace
+
+void GeoSvc::cellIDPositions(gsl::span<const dd4hep::CellID> ids,
+                             gsl::span<dd4hep::Position> positions) const {
+  if (positions.size() < ids.size()) {
+    raise(fmt::format("Cannot convert {} cellIDs into {} positions", ids.size(),
+                      positions.size()));
+  }
+  const size_t n = ids.size();
+  if (m_snapshot) {
+    for (size_t i = 0; i < n; ++i) {
+      positions[i] = snapshotPosition(ids[i]);
+    }
+    return;
+  }
+
+  const auto converter = cellIDPositionConverter();
+
+  // Volume context of every cell. Hits tend to come sorted by cellID, so the lookup is
+  // skipped as long as consecutive cells are in the same volume.
+  std::vector<std::pair<const dd4hep::VolumeManagerContext*, size_t>> cells(n);
+  const dd4hep::VolumeManagerContext* context = nullptr;
+  for (size_t i = 0; i < n; ++i) {
+    if (!context || (ids[i] & context->mask) != context->identifier) {
+      context = converter->findContext(ids[i]);
+    }
+    cells[i] = {context, i};
+  }
+  std::sort(cells.begin(), cells.end());
+
+  // Scratch space for one group of cells, in structure-of-arrays layout
+  std::vector<dd4hep::CellID> group_ids;
+  std::vector<double> x, y, z;
+
+  for (auto begin = cells.begin(); begin != cells.end();) {
+    context        = begin->first;
+    const auto end = std::find_if(begin, cells.end(),
+                                  [context](const auto& c) { return c.first != context; });
+    if (!context) {
+      // cells not in any known volume, same result as the CellIDPositionConverter
+      for (auto it = begin; it != end; ++it) {
+        positions[it->second] = dd4hep::Position();
+      }
+      begin = end;
+      continue;
+    }
+    const size_t m = end - begin;
+    group_ids.resize(m);
+    x.resize(m);
+    y.resize(m);
+    z.resize(m);
+    for (size_t k = 0; k < m; ++k) {
+      group_ids[k] = ids[begin[k].second];
+    }
+
+    // Local positions: Cartesian grids are decoded and computed in bulk, other
+    // segmentations go through the (virtual) per-cell call
+    const dd4hep::Segmentation segmentation =
+        converter->findReadout(context->element).segmentation();
+    const auto* grid =
+        dynamic_cast<const dd4hep::DDSegmentation::CartesianGridXY*>(segmentation.segmentation());
+    if (grid) {
+      const auto* decoder   = segmentation.decoder();
+      const auto field_x    = toField((*decoder)[grid->fieldNameX()]);
+      const auto field_y    = toField((*decoder)[grid->fieldNameY()]);
+      const double size_x   = grid->gridSizeX();
+      const double size_y   = grid->gridSizeY();
+      const double offset_x = grid->offsetX();
+      const double offset_y = grid->offsetY();
+      for (size_t k = 0; k < m; ++k) {
+        x[k] = field_x(group_ids[k]) * size_x + offset_x;
+        y[k] = field_y(group_ids[k]) * size_y + offset_y;
+        z[k] = 0.;
+      }
+    } else {
+      for (size_t k = 0; k < m; ++k) {
+        const auto local = segmentation.position(group_ids[k]);
+        x[k]             = local.x();
+        y[k]             = local.y();
+        z[k]             = local.z();
+      }
+    }
+
+    // Place the whole group in the world with a single transform
+    const Transform tr{*context};
+    for (size_t k = 0; k < m; ++k) {
+      const double gx = tr.r[0] * x[k] + tr.r[1] * y[k] + tr.r[2] * z[k] + tr.t[0];
+      const double gy = tr.r[3] * x[k] + tr.r[4] * y[k] + tr.r[5] * z[k] + tr.t[1];
+      const double gz = tr.r[6] * x[k] + tr.r[7] * y[k] + tr.r[8] * z[k] + tr.t[2];
+      x[k]            = gx;
+      y[k]            = gy;
+      z[k]            = gz;
+    }
+    for (size_t k = 0; k < m; ++k) {
+      positions[begin[k].second] = dd4hep::Position(x[k], y[k], z[k]);
+    }
+    begin = end;
+  }
+}
+
 void GeoSvc::init(const dd4hep::Detector* det) {
+  initSubdetectors();
+  m_position_cache.maxSize(m_max_cached_positions.value());
+  if (!det && !m_snapshot_path.value().empty()) {
+    info() << fmt::format("No external detector provided, mapping geometry snapshot {}",
+                          m_snapshot_path.value())
+           << endmsg;
+    InitTimer timer{"geo", "GeoSnapshot"};
+    m_snapshot =
+        std::make_unique<const GeoSnapshot>(m_snapshot_path.value(), m_verify_snapshot.value());
+    for (const auto& readout : m_snapshot->readouts()) {
+      debug() << fmt::format("Readout {} with {} cells", readout.name, readout.cells.size())
+              << endmsg;
+    }
+    for (const auto& name : m_indexed_readouts.value()) {
+      const auto* readout = m_snapshot->readout(name);
+      if (!readout) {
+        raise(fmt::format("Cannot index readout {}, not in the geometry snapshot", name));
+      }
+      buildCellIndex(name, readout->cells);
+    }
+    for (const auto& readout : m_snapshot->readouts()) {
+      cellIDDecoder(readout.name);
+    }
+    return;
+  }
   if (det) {
     info() << "Initializing geometry service from pre-initialized detector" << endmsg;
     m_detector = det;
     // no detector given, need to self-initialize
   } else {
     info() << "No external detector provided, self-initializing" << endmsg;
-    auto detector = dd4hep::Detector::make_unique("");
+    if (m_xml_list.empty() && !m_subdetector_list.empty()) {
+      info() << "No compact files to load up front, only loading subdetectors on first access"
+             << endmsg;
+      return;
+    }
     if (m_xml_list.empty()) {
-      // TODO handle error
+      raise("No geometry to load: set the detectors, subdetectors or snapshot property, or "
+            "provide a detector");
+    }
+    m_detector_ptr = load(m_xml_list.value());
+    m_detector     = m_detector_ptr.get();
+  }
+  // always: instantiate cellIDConverter
+  {
+    InitTimer timer{"geo", "CellIDPositionConverter"};
+    m_converter = std::make_unique<const dd4hep::rec::CellIDPositionConverter>(*m_detector);
+  }
+  // and resolve the cellID decoders of all readouts
+  for (const auto& [name, readout] : m_detector->readouts()) {
+    cellIDDecoder(name);
+  }
+}
+
+uint64_t GeoSvc::fingerprint() const {
+  const auto det = detector();
+  std::string contents;
+  if (m_detector_ptr) {
+    for (const auto& file : m_xml_list.value()) {
+      std::ifstream in{file, std::ios::binary};
+      if (!in) {
+        raise(fmt::format("Cannot read compact file {} to fingerprint the geometry", file));
+      }
+      contents.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      contents.push_back('\0');
+    }
+  } else {
+    for (const auto& [name, readout] : det->readouts()) {
+      contents += fmt::format("{}={}\n", name, idSpec(name));
+    }
+  }
+  return detail::checksum(contents.data(), contents.size());
+}
+
+const CellIDDecoder& GeoSvc::cellIDDecoder(std::string_view readout) const {
+  {
+    std::lock_guard<std::mutex> lock{m_decoder_mutex};
+    const auto it = m_decoders.find(readout);
+    if (it != m_decoders.end()) {
+      return *it->second;
     }
-    for (std::string_view name : m_xml_list) {
-      info() << fmt::format("Loading compact file: {}", "name") << endmsg;
-      detector->fromCompact(std::string(name));
+  }
+  // not resolved at init, e.g. a readout of a lazily loaded subdetector
+  auto decoder = std::make_unique<const CellIDDecoder>(idSpec(readout));
+  std::lock_guard<std::mutex> lock{m_decoder_mutex};
+  return *m_decoders.try_emplace(std::string(readout), std::move(decoder)).first->second;
+}
+
+std::string GeoSvc::idSpec(std::string_view readout) const {
+  if (m_snapshot) {
+    const auto* r = m_snapshot->readout(readout);
+    if (!r) {
+      raise(fmt::format("Unknown readout {}, not in the geometry snapshot", readout));
     }
+    return std::string(r->id_spec);
+  }
+  const auto* det = m_readout_subdetectors.count(readout)
+                        ? subdetectorForReadout(readout).detector.get()
+                        : detector().get();
+  return det->readout(std::string(readout)).idSpec().fieldDescription();
+}
+
+const GeoSvc::Subdetector& GeoSvc::subdetector(std::string_view name) const {
+  const auto it = m_subdetectors.find(name);
+  if (it == m_subdetectors.end()) {
+    raise(fmt::format("Unknown subdetector {} (not in the subdetectors property)", name));
+  }
+  auto& entry = it->second;
+  // concurrent first accesses wait for a single load, a failed load is retried next time
+  std::call_once(entry.loaded, [&] {
+    info() << fmt::format("Loading subdetector {} on first access", name) << endmsg;
+    auto detector = load({entry.compact}, name);
+    InitTimer timer{"geo", fmt::format("{} CellIDPositionConverter", name)};
+    entry.geometry.converter =
+        std::make_unique<const dd4hep::rec::CellIDPositionConverter>(*detector);
+    entry.geometry.detector = std::move(detector);
+  });
+  return entry.geometry;
+}
+
+const GeoSvc::Subdetector& GeoSvc::subdetectorForReadout(std::string_view readout) const {
+  const auto it = m_readout_subdetectors.find(readout);
+  if (it == m_readout_subdetectors.end()) {
+    raise(fmt::format("No subdetector provides readout {} (not in the subdetectorReadouts "
+                      "property)",
+                      readout));
+  }
+  return subdetector(it->second);
+}
+
+std::vector<std::string_view> GeoSvc::subdetectors() const {
+  std::vector<std::string_view> ret;
+  for (const auto& [name, entry] : m_subdetectors) {
+    ret.push_back(name);
+  }
+  return ret;
+}
+
+std::unique_ptr<const dd4hep::Detector> GeoSvc::load(const std::vector<std::string>& files,
+                                                     std::string_view name) const {
+  // each (sub)detector gets its own DD4hep instance, with its own volume manager
+  auto detector = dd4hep::Detector::make_unique(std::string(name));
+  for (std::string_view file : files) {
+    info() << fmt::format("Loading compact file: {}", file) << endmsg;
+    InitTimer timer{"geo", file};
+    detector->fromCompact(std::string(file));
+  }
+  {
+    InitTimer timer{"geo", name.empty() ? std::string("DD4hepVolumeManager")
+                                        : fmt::format("{} DD4hepVolumeManager", name)};
     detector->volumeManager();
     detector->apply("DD4hepVolumeManager", 0, nullptr);
-    m_detector_ptr = std::move(detector);
-    m_detector = m_detector_ptr.get();
   }
-  // always: instantiate cellIDConverter
-  m_converter = std::make_unique<const dd4hep::rec::CellIDPositionConverter>(*m_detector);
+  return detector;
+}
+
+void GeoSvc::initSubdetectors() {
+  // "name=compact file" and "readout=name" entries
+  const auto split = [this](std::string_view entry, std::string_view property) {
+    const auto pos = entry.find('=');
+    if (pos == std::string_view::npos || pos == 0 || pos + 1 == entry.size()) {
+      raise(fmt::format("Invalid {} entry '{}', expected <key>=<value>", property, entry));
+    }
+    return std::pair{std::string(entry.substr(0, pos)), std::string(entry.substr(pos + 1))};
+  };
+  m_subdetectors.clear();
+  m_readout_subdetectors.clear();
+  for (std::string_view entry : m_subdetector_list) {
+    auto [name, compact] = split(entry, "subdetectors");
+    m_subdetectors[name].compact = std::move(compact);
+  }
+  for (std::string_view entry : m_readout_list) {
+    auto [readout, name] = split(entry, "subdetectorReadouts");
+    if (!m_subdetectors.count(name)) {
+      raise(fmt::format("Readout {} refers to unknown subdetector {}", readout, name));
+    }
+    m_readout_subdetectors[readout] = std::move(name);
+  }
 }
+
+const CellIndex& GeoSvc::buildCellIndex(std::string_view readout,
+                                        gsl::span<const dd4hep::CellID> cells,
+                                        const double neighbor_distance) {
+  InitTimer timer{"geo", fmt::format("{} CellIndex", readout)};
+  std::vector<dd4hep::Position> positions(cells.size());
+  cellIDPositions(cells, positions);
+  auto index = std::make_unique<const CellIndex>(cells, positions, neighbor_distance);
+  info() << fmt::format("Indexed {} cells of readout {} (neighbor distance {})", index->size(),
+                        readout, index->neighborDistance())
+         << endmsg;
+  std::lock_guard<std::mutex> lock{m_cell_index_mutex};
+  // never replace an index, algorithms may hold references to it
+  const auto [it, inserted] = m_cell_indices.try_emplace(std::string(readout), std::move(index));
+  if (!inserted) {
+    raise(fmt::format("Cell index for readout {} was already built", readout));
+  }
+  return *it->second;
+}
+
+const CellIndex& GeoSvc::cellIndex(std::string_view readout) const {
+  std::lock_guard<std::mutex> lock{m_cell_index_mutex};
+  const auto it = m_cell_indices.find(readout);
+  if (it == m_cell_indices.end()) {
+    raise(fmt::format("No cell index for readout {}", readout));
+  }
+  return *it->second;
+}
+
+void GeoSvc::writeSnapshot(
+    const std::string& path,
+    const std::map<std::string, std::vector<dd4hep::CellID>>& readouts) const {
+  std::vector<GeoSnapshot::ReadoutData> data;
+  std::vector<dd4hep::Position> positions;
+  for (const auto& [name, cells] : readouts) {
+    auto& readout   = data.emplace_back();
+    readout.name    = name;
+    readout.id_spec = idSpec(name);
+    positions.resize(cells.size());
+    cellIDPositions(cells, positions);
+    readout.cells.reserve(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+      readout.cells.emplace_back(cells[i], positions[i]);
+    }
+  }
+  GeoSnapshot::write(path, std::move(data));
+  info() << fmt::format("Wrote geometry snapshot of {} readouts to {}", readouts.size(), path)
+         << endmsg;
+}
+
+void GeoSvc::cacheCellIDPositions(gsl::span<const dd4hep::CellID> ids) const {
+  if (m_snapshot) {
+    return; // already tabulated
+  }
+  // convert outside of the lock
+  const auto converter = cellIDPositionConverter();
+  std::vector<dd4hep::Position> positions;
+  positions.reserve(ids.size());
+  for (const auto id : ids) {
+    positions.push_back(converter->position(id));
+  }
+  std::lock_guard<std::mutex> lock{m_position_table_mutex};
+  // the new table also contains the cells of the current one
+  const auto* current = m_position_table.load(std::memory_order_relaxed);
+  std::vector<std::pair<dd4hep::CellID, dd4hep::Position>> entries;
+  entries.reserve(ids.size() + (current ? current->size() : 0));
+  if (current) {
+    current->forEach([&](const dd4hep::CellID id, const dd4hep::Position& position) {
+      entries.emplace_back(id, position);
+    });
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    entries.emplace_back(ids[i], positions[i]);
+  }
+  m_position_tables.push_back(std::make_unique<const PositionTable>(entries));
+  m_position_table.store(m_position_tables.back().get(), std::memory_order_release);
+  debug() << fmt::format("Position table with {} cells", m_position_tables.back()->size())
+          << endmsg;
+}
+
+size_t GeoSvc::cachedCellIDPositions() const {
+  const auto* table = m_position_table.load(std::memory_order_acquire);
+  return (table ? table->size() : 0) + m_position_cache.size();
+}
+
+dd4hep::Position GeoSvc::snapshotPosition(const dd4hep::CellID id) const {
+  const auto pos = m_snapshot->position(id);
+  if (!pos) {
+    raise(fmt::format("CellID {:#x} not found in geometry snapshot {}", id, m_snapshot->path()));
+  }
+  return *pos;
+}
+
 } // namespace algorithms
 
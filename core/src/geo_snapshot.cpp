@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the binary geometry snapshot
+//
+#include <algorithms/geo_snapshot.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <algorithms/cellid_decoder.h>
+
+namespace algorithms {
+
+namespace {
+  constexpr std::array<char, 8> kMagic{'A', 'L', 'G', 'O', 'G', 'E', 'O', '\0'};
+  constexpr uint32_t kByteOrder = 0x01020304;
+  constexpr size_t kHeaderSize  = kMagic.size() + 3 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+  constexpr size_t kAlignment   = 8;
+
+  // padding needed to align a file offset
+  size_t padding(const size_t offset) { return (kAlignment - offset % kAlignment) % kAlignment; }
+
+  template <class T> gsl::span<const T> readArray(detail::ByteReader& in, const size_t n) {
+    const auto* data = in.take(n * sizeof(T));
+    return {reinterpret_cast<const T*>(data), n};
+  }
+
+  // Mask of the system field of a cellID description, 0 if there is none
+  uint64_t systemMask(std::string_view id_spec) {
+    const CellIDDecoder decoder{id_spec};
+    for (size_t i = 0; i < decoder.size(); ++i) {
+      if (decoder.name(i) == "system") {
+        return decoder[i].mask();
+      }
+    }
+    return 0;
+  }
+} // namespace
+
+std::optional<dd4hep::Position> GeoSnapshot::Readout::position(const dd4hep::CellID id) const {
+  const auto it = std::lower_bound(cells.begin(), cells.end(), id);
+  if (it == cells.end() || *it != id) {
+    return std::nullopt;
+  }
+  const size_t i = it - cells.begin();
+  return dd4hep::Position(x[i], y[i], z[i]);
+}
+
+void GeoSnapshot::write(const std::string& path, std::vector<ReadoutData> readouts) {
+  std::sort(readouts.begin(), readouts.end(),
+            [](const auto& a, const auto& b) { return a.name < b.name; });
+
+  std::ostringstream payload;
+  uint64_t index = detail::checksum(nullptr, 0);
+  for (auto& readout : readouts) {
+    auto& cells = readout.cells;
+    std::sort(cells.begin(), cells.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    cells.erase(std::unique(cells.begin(), cells.end(),
+                            [](const auto& a, const auto& b) { return a.first == b.first; }),
+                cells.end());
+
+    std::vector<uint64_t> systems;
+    if (const auto mask = systemMask(readout.id_spec)) {
+      for (const auto& [id, pos] : cells) {
+        systems.push_back(id & mask);
+      }
+      std::sort(systems.begin(), systems.end());
+      systems.erase(std::unique(systems.begin(), systems.end()), systems.end());
+    }
+
+    std::ostringstream header;
+    detail::writeBinaryString(header, readout.name);
+    detail::writeBinaryString(header, readout.id_spec);
+    detail::writeBinary(header, static_cast<uint64_t>(cells.size()));
+    detail::writeBinary(header, static_cast<uint32_t>(systems.size()));
+    for (const auto bits : systems) {
+      detail::writeBinary(header, bits);
+    }
+    const std::string bytes = header.str();
+    index                   = detail::checksum(bytes.data(), bytes.size(), index);
+    payload.write(bytes.data(), bytes.size());
+    const size_t pad = padding(kHeaderSize + static_cast<size_t>(payload.tellp()));
+    payload.write(std::array<char, kAlignment>{}.data(), pad);
+    for (const auto& [id, pos] : cells) {
+      detail::writeBinary(payload, static_cast<uint64_t>(id));
+    }
+    for (const auto& [id, pos] : cells) {
+      detail::writeBinary(payload, static_cast<double>(pos.x()));
+    }
+    for (const auto& [id, pos] : cells) {
+      detail::writeBinary(payload, static_cast<double>(pos.y()));
+    }
+    for (const auto& [id, pos] : cells) {
+      detail::writeBinary(payload, static_cast<double>(pos.z()));
+    }
+  }
+  const std::string data = payload.str();
+
+  std::ofstream out{path, std::ios::binary};
+  if (!out) {
+    throw GeoSnapshotError(fmt::format("Failed to open {} to write the geometry snapshot", path));
+  }
+  out.write(kMagic.data(), kMagic.size());
+  detail::writeBinary(out, kByteOrder);
+  detail::writeBinary(out, kVersion);
+  detail::writeBinary(out, static_cast<uint32_t>(readouts.size()));
+  detail::writeBinary(out, static_cast<uint64_t>(data.size()));
+  detail::writeBinary(out, index);
+  detail::writeBinary(out, detail::checksum(data.data(), data.size()));
+  out.write(data.data(), data.size());
+}
+
+GeoSnapshot::GeoSnapshot(const std::string& path, const bool verify) : m_file{path} {
+  try {
+    detail::ByteReader in{m_file.data(), m_file.size()};
+    if (std::memcmp(in.take(kMagic.size()), kMagic.data(), kMagic.size()) != 0) {
+      throw GeoSnapshotError("not a geometry snapshot");
+    }
+    if (in.read<uint32_t>() != kByteOrder) {
+      throw GeoSnapshotError("snapshot was written with a different byte order");
+    }
+    if (const auto version = in.read<uint32_t>(); version != kVersion) {
+      throw GeoSnapshotError(
+          fmt::format("unsupported version {} (expected {})", version, kVersion));
+    }
+    const auto nreadouts      = in.read<uint32_t>();
+    const auto size           = in.read<uint64_t>();
+    const auto expected_index = in.read<uint64_t>();
+    const auto expected       = in.read<uint64_t>();
+    if (size != m_file.size() - kHeaderSize) {
+      throw GeoSnapshotError("inconsistent payload size");
+    }
+    const auto* bytes = reinterpret_cast<const char*>(m_file.data());
+    if (verify && detail::checksum(bytes + kHeaderSize, size) != expected) {
+      throw GeoSnapshotError("checksum mismatch");
+    }
+    // the tables are used in place, so no parsing beyond the readout headers
+    uint64_t index = detail::checksum(nullptr, 0);
+    m_readouts.reserve(nreadouts);
+    for (uint32_t i = 0; i < nreadouts; ++i) {
+      const size_t begin = in.position();
+      Readout readout;
+      readout.name    = in.readString();
+      readout.id_spec = in.readString();
+      const auto n    = in.read<uint64_t>();
+      if (n > m_file.size() / (4 * sizeof(uint64_t))) {
+        throw GeoSnapshotError(fmt::format("invalid number of cells for {}", readout.name));
+      }
+      const auto nsystems = in.read<uint32_t>();
+      if (nsystems > n) {
+        throw GeoSnapshotError(fmt::format("invalid number of systems for {}", readout.name));
+      }
+      const uint64_t mask = nsystems ? systemMask(readout.id_spec) : 0;
+      if (nsystems && !mask) {
+        throw GeoSnapshotError(fmt::format("systems listed for {}, but it has no system field",
+                                           readout.name));
+      }
+      for (uint32_t s = 0; s < nsystems; ++s) {
+        m_systems.push_back({mask, in.read<uint64_t>(), i});
+      }
+      if (!mask) {
+        m_unindexed.push_back(i);
+      } else if (std::find(m_system_masks.begin(), m_system_masks.end(), mask) ==
+                 m_system_masks.end()) {
+        m_system_masks.push_back(mask);
+      }
+      index = detail::checksum(bytes + begin, in.position() - begin, index);
+      in.take(padding(in.position()));
+      readout.cells = readArray<dd4hep::CellID>(in, n);
+      readout.x     = readArray<double>(in, n);
+      readout.y     = readArray<double>(in, n);
+      readout.z     = readArray<double>(in, n);
+      if (!std::is_sorted(readout.cells.begin(), readout.cells.end())) {
+        throw GeoSnapshotError(fmt::format("cells of {} are not sorted", readout.name));
+      }
+      m_readouts.push_back(readout);
+    }
+    if (!in.done()) {
+      throw GeoSnapshotError("trailing data after last readout");
+    }
+    if (index != expected_index) {
+      throw GeoSnapshotError("index checksum mismatch");
+    }
+    std::sort(m_systems.begin(), m_systems.end());
+  } catch (const Error& e) {
+    throw GeoSnapshotError(fmt::format("Invalid geometry snapshot {}: {}", path, e.what()));
+  }
+}
+
+const GeoSnapshot::Readout* GeoSnapshot::readout(std::string_view name) const {
+  const auto it = std::lower_bound(m_readouts.begin(), m_readouts.end(), name,
+                                   [](const auto& r, std::string_view n) { return r.name < n; });
+  return (it != m_readouts.end() && it->name == name) ? &*it : nullptr;
+}
+
+std::optional<dd4hep::Position> GeoSnapshot::position(const dd4hep::CellID id) const {
+  // cellIDs of different readouts differ in their system field, so the first match wins
+  for (const auto mask : m_system_masks) {
+    const SystemEntry key{mask, id & mask, 0};
+    for (auto it = std::lower_bound(m_systems.begin(), m_systems.end(), key);
+         it != m_systems.end() && it->mask == key.mask && it->bits == key.bits; ++it) {
+      if (auto pos = m_readouts[it->readout].position(id)) {
+        return pos;
+      }
+    }
+  }
+  for (const auto i : m_unindexed) {
+    if (auto pos = m_readouts[i].position(id)) {
+      return pos;
+    }
+  }
+  return std::nullopt;
+}
+
+} // namespace algorithms
@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the histogram service
+//
+#include <algorithms/histogram.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace algorithms {
+
+namespace detail {
+  thread_local HistogramShard* t_histogram_shard = nullptr;
+} // namespace detail
+
+namespace {
+  template <class T> bool parse(std::string_view token, T& value) {
+    const auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return ec == std::errc() && end == token.data() + token.size();
+  }
+
+  bool validName(std::string_view name) {
+    return !name.empty() && name.find_first_of(" \t\n\r\f\v") == std::string_view::npos;
+  }
+} // namespace
+
+Axis::Axis(const size_t nbins, const double min, const double max)
+    : m_nbins{nbins}, m_min{min}, m_max{max}, m_scale{nbins / (max - min)} {
+  if (nbins == 0 || !std::isfinite(min) || !std::isfinite(max) || !(max > min)) {
+    throw HistogramError(
+        fmt::format("Invalid histogram axis: {} bins in [{}, {})", nbins, min, max));
+  }
+}
+
+Histogram::Histogram(std::string_view name, std::string_view title, const Axis& x)
+    : m_name{name}
+    , m_title{title}
+    , m_axes{x}
+    , m_sumw(x.nbins() + 2, 0.)
+    , m_sumw2(x.nbins() + 2, 0.) {}
+
+Histogram::Histogram(std::string_view name, std::string_view title, const Axis& x,
+                     const Axis& y)
+    : m_name{name}
+    , m_title{title}
+    , m_axes{x, y}
+    , m_sumw((x.nbins() + 2) * (y.nbins() + 2), 0.)
+    , m_sumw2((x.nbins() + 2) * (y.nbins() + 2), 0.) {}
+
+void Histogram::add(const Histogram& other) {
+  if (!sameBinning(other)) {
+    throw HistogramError(fmt::format("Cannot add histogram {} to {} with different binning",
+                                     other.m_name, m_name));
+  }
+  m_entries += other.m_entries;
+  for (size_t i = 0; i < m_sumw.size(); ++i) {
+    m_sumw[i] += other.m_sumw[i];
+    m_sumw2[i] += other.m_sumw2[i];
+  }
+}
+
+void Histogram::reset() {
+  m_entries = 0;
+  std::fill(m_sumw.begin(), m_sumw.end(), 0.);
+  std::fill(m_sumw2.begin(), m_sumw2.end(), 0.);
+}
+
+size_t Histogram::bin(const size_t ix, const size_t iy) const {
+  const size_t nx = m_axes[0].nbins() + 2;
+  const size_t ny = dimension() > 1 ? m_axes[1].nbins() + 2 : 1;
+  if (ix >= nx || iy >= ny) {
+    throw HistogramError(fmt::format("Bin ({}, {}) out of range for histogram {}", ix, iy,
+                                     m_name));
+  }
+  return ix + nx * iy;
+}
+
+double Histogram::error(const size_t ix, const size_t iy) const {
+  return std::sqrt(m_sumw2[bin(ix, iy)]);
+}
+
+double Histogram::integral() const {
+  const size_t nx = m_axes[0].nbins();
+  const size_t ny = dimension() > 1 ? m_axes[1].nbins() : 0;
+  double sum      = 0;
+  for (size_t iy = ny > 0 ? 1 : 0; iy <= ny; ++iy) {
+    for (size_t ix = 1; ix <= nx; ++ix) {
+      sum += m_sumw[ix + (nx + 2) * iy];
+    }
+  }
+  return sum;
+}
+
+void Histogram::write(const std::string& path, const std::vector<Histogram>& histograms) {
+  std::ofstream out{path};
+  if (!out) {
+    throw HistogramError(fmt::format("Failed to open {} to write the histograms", path));
+  }
+  // values are written with the shortest representation that reads back exactly
+  for (const auto& h : histograms) {
+    out << fmt::format("histogram {} {} {}\n", h.m_name, h.dimension(), h.m_entries);
+    out << fmt::format("title {}\n", h.m_title);
+    for (const auto& axis : h.m_axes) {
+      out << fmt::format("axis {} {} {}\n", axis.nbins(), axis.min(), axis.max());
+    }
+    out << fmt::format("sumw {}\n", fmt::join(h.m_sumw, " "));
+    out << fmt::format("sumw2 {}\n", fmt::join(h.m_sumw2, " "));
+  }
+  if (!out) {
+    throw HistogramError(fmt::format("Failed to write the histograms to {}", path));
+  }
+}
+
+std::vector<Histogram> Histogram::read(const std::string& path) {
+  std::ifstream in{path};
+  if (!in) {
+    throw HistogramError(fmt::format("Failed to open histogram file {}", path));
+  }
+  std::vector<Histogram> ret;
+  std::string line;
+  size_t lineno = 0;
+  // next line, split into its keyword and the rest of the line
+  const auto next = [&](std::string_view keyword) {
+    ++lineno;
+    if (!std::getline(in, line) || line.compare(0, keyword.size(), keyword) != 0 ||
+        line.size() <= keyword.size() || line[keyword.size()] != ' ') {
+      throw HistogramError(
+          fmt::format("Invalid histogram file {}:{}: expected '{}'", path, lineno, keyword));
+    }
+    return std::istringstream{line.substr(keyword.size() + 1)};
+  };
+  const auto invalid = [&]() {
+    return HistogramError(fmt::format("Invalid histogram file {}:{}: '{}'", path, lineno, line));
+  };
+  const auto values = [&](std::string_view keyword, std::vector<double>& v) {
+    auto tokens = next(keyword);
+    size_t i    = 0;
+    for (std::string token; tokens >> token; ++i) {
+      if (i >= v.size() || !parse(token, v[i])) {
+        throw invalid();
+      }
+    }
+    if (i != v.size()) {
+      throw invalid();
+    }
+  };
+
+  while (in.peek() != std::char_traits<char>::eof()) {
+    std::string name, token;
+    size_t dimension;
+    uint64_t entries;
+    if (!(next("histogram") >> name >> dimension >> entries) ||
+        (dimension != 1 && dimension != 2)) {
+      throw invalid();
+    }
+    next("title");
+    const std::string title = line.substr(std::string_view{"title "}.size());
+    std::vector<Axis> axes;
+    for (size_t i = 0; i < dimension; ++i) {
+      size_t nbins;
+      double min, max;
+      auto tokens = next("axis");
+      if (!(tokens >> nbins >> min >> max) || tokens >> token) {
+        throw invalid();
+      }
+      try {
+        axes.emplace_back(nbins, min, max);
+      } catch (const HistogramError&) {
+        throw invalid();
+      }
+    }
+    Histogram h = dimension == 1 ? Histogram{name, title, axes[0]}
+                                 : Histogram{name, title, axes[0], axes[1]};
+    h.m_entries = entries;
+    values("sumw", h.m_sumw);
+    values("sumw2", h.m_sumw2);
+    ret.push_back(std::move(h));
+  }
+  return ret;
+}
+
+void HistogramSvc::init() {
+  debug() << fmt::format("Histograms will be written to {}", m_output.value()) << endmsg;
+}
+
+HistogramSvc::Handle1D HistogramSvc::book(std::string_view name, std::string_view title,
+                                          const Axis& x) {
+  return {book(Histogram{name, title, x})};
+}
+
+HistogramSvc::Handle2D HistogramSvc::book(std::string_view name, std::string_view title,
+                                          const Axis& x, const Axis& y) {
+  return {book(Histogram{name, title, x, y})};
+}
+
+uint32_t HistogramSvc::book(Histogram&& histogram) {
+  if (!validName(histogram.name())) {
+    raise<HistogramError>(fmt::format("Invalid histogram name '{}'", histogram.name()));
+  }
+  if (histogram.title().find('\n') != std::string::npos) {
+    raise<HistogramError>(fmt::format("Invalid title of histogram {}", histogram.name()));
+  }
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const auto it = m_ids.find(histogram.name());
+  if (it != m_ids.end()) {
+    if (!m_booked[it->second].sameBinning(histogram)) {
+      raise<HistogramError>(fmt::format(
+          "Histogram {} was already booked with a different binning", histogram.name()));
+    }
+    return it->second;
+  }
+  const auto id = static_cast<uint32_t>(m_booked.size());
+  m_ids.emplace(histogram.name(), id);
+  m_booked.push_back(std::move(histogram));
+  return id;
+}
+
+Histogram& HistogramSvc::createLocal(const uint32_t id) const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  if (id >= m_booked.size()) {
+    raise<HistogramError>(fmt::format("Fill of a histogram that was not booked (id {})", id));
+  }
+  auto* shard = detail::t_histogram_shard;
+  if (!shard) {
+    // owned by the service, so the histograms are kept after the thread exits
+    m_shards.push_back(std::make_unique<detail::HistogramShard>());
+    shard = detail::t_histogram_shard = m_shards.back().get();
+  }
+  if (shard->size() < m_booked.size()) {
+    shard->resize(m_booked.size());
+  }
+  auto& local = (*shard)[id];
+  if (!local) {
+    local = std::make_unique<Histogram>(m_booked[id]);
+  }
+  return *local;
+}
+
+Histogram HistogramSvc::merge(std::string_view name) const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const auto it = m_ids.find(name);
+  if (it == m_ids.end()) {
+    raise<HistogramError>(fmt::format("No histogram {} was booked", name));
+  }
+  Histogram ret = m_booked[it->second];
+  for (const auto& shard : m_shards) {
+    if (it->second < shard->size() && (*shard)[it->second]) {
+      ret.add(*(*shard)[it->second]);
+    }
+  }
+  return ret;
+}
+
+std::vector<Histogram> HistogramSvc::merge() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  std::vector<Histogram> ret = m_booked;
+  for (const auto& shard : m_shards) {
+    for (size_t id = 0; id < shard->size(); ++id) {
+      if ((*shard)[id]) {
+        ret[id].add(*(*shard)[id]);
+      }
+    }
+  }
+  return ret;
+}
+
+void HistogramSvc::write(const std::string& path) const {
+  const auto histograms = merge();
+  Histogram::write(path, histograms);
+  info() << fmt::format("Wrote {} histograms to {}", histograms.size(), path) << endmsg;
+}
+
+void HistogramSvc::reset() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  for (const auto& shard : m_shards) {
+    for (const auto& h : *shard) {
+      if (h) {
+        h->reset();
+      }
+    }
+  }
+}
+
+std::vector<std::string_view> HistogramSvc::histograms() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  std::vector<std::string_view> ret;
+  for (const auto& [name, id] : m_ids) {
+    ret.push_back(name);
+  }
+  return ret;
+}
+
+size_t HistogramSvc::shards() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_shards.size();
+}
+
+} // namespace algorithms
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Allocation hooks of the MemoryTracker: replacements of the global operator new and
+// delete. Built as the algorithms::memhooks object library, to be linked into executables
+// only, so the replacement is in place before the first allocation of the process. Never
+// link it into a shared library: one that is loaded later with dlopen() would free memory
+// allocated before it was loaded.
+//
+#include <algorithms/memory.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace algorithms {
+
+namespace {
+  // Every allocation is prefixed with the scope that made it, its size, and a tag that
+  // marks it as allocated here. The tag is stored just before the returned pointer, so for
+  // memory that was not allocated here it overlaps the bookkeeping of malloc() (readable),
+  // and deallocate() falls back to free()
+  struct Header {
+    MemoryStats* scope;
+    size_t size;
+    uintptr_t tag;
+  };
+  constexpr uintptr_t kMagic         = 0xa1905c09e3a11cedULL;
+  constexpr size_t kDefaultAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+  // space reserved for the header, keeping the default alignment of the returned pointer
+  constexpr size_t kHeaderSpace =
+      (sizeof(Header) + kDefaultAlignment - 1) / kDefaultAlignment * kDefaultAlignment;
+
+  // the tag depends on the address, so stale or copied headers do not match
+  uintptr_t tag(const void* ptr) { return kMagic ^ reinterpret_cast<uintptr_t>(ptr); }
+
+  // Offset of the returned pointer in the underlying malloc() block, the header is
+  // stored just before the returned pointer
+  constexpr size_t offset(const size_t alignment) { return std::max(kHeaderSpace, alignment); }
+
+  void* allocate(const size_t size, const size_t alignment) noexcept {
+    // aligned_alloc() requires the size to be a multiple of the alignment
+    const size_t total = (size + offset(alignment) + alignment - 1) / alignment * alignment;
+    void* raw = alignment > kDefaultAlignment ? std::aligned_alloc(alignment, total)
+                                              : std::malloc(total);
+    if (!raw) {
+      return nullptr;
+    }
+    void* ptr   = static_cast<char*>(raw) + offset(alignment);
+    Header* hdr = static_cast<Header*>(ptr) - 1;
+    hdr->scope  = detail::t_memory_scope;
+    hdr->size   = size;
+    hdr->tag    = tag(ptr);
+    if (hdr->scope) {
+      hdr->scope->allocated(size);
+    }
+    return ptr;
+  }
+  void* allocateOrThrow(const size_t size, const size_t alignment) {
+    while (true) {
+      if (void* ptr = allocate(size, alignment)) {
+        return ptr;
+      }
+      const auto handler = std::get_new_handler();
+      if (!handler) {
+        throw std::bad_alloc();
+      }
+      handler();
+    }
+  }
+  void deallocate(void* ptr, const size_t alignment) noexcept {
+    if (!ptr) {
+      return;
+    }
+    Header* hdr = static_cast<Header*>(ptr) - 1;
+    if (hdr->tag != tag(ptr)) {
+      // not allocated through these hooks
+      std::free(ptr);
+      return;
+    }
+    hdr->tag = 0;
+    if (hdr->scope) {
+      hdr->scope->deallocated(hdr->size);
+    }
+    std::free(static_cast<char*>(ptr) - offset(alignment));
+  }
+
+  // report the hooks to the MemoryTracker
+  const bool g_registered = (detail::registerAllocationHooks(), true);
+} // namespace
+
+} // namespace algorithms
+
+// Replacements of all forms of the global operator new and delete, so they consistently
+// use the header of allocate() whichever form the standard library forwards to
+using algorithms::allocate;
+using algorithms::allocateOrThrow;
+using algorithms::deallocate;
+using algorithms::kDefaultAlignment;
+
+void* operator new(std::size_t size) { return allocateOrThrow(size, kDefaultAlignment); }
+void* operator new[](std::size_t size) { return allocateOrThrow(size, kDefaultAlignment); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, kDefaultAlignment);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size, kDefaultAlignment);
+}
+void* operator new(std::size_t size, std::align_val_t al) {
+  return allocateOrThrow(size, static_cast<size_t>(al));
+}
+void* operator new[](std::size_t size, std::align_val_t al) {
+  return allocateOrThrow(size, static_cast<size_t>(al));
+}
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<size_t>(al));
+}
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+  return allocate(size, static_cast<size_t>(al));
+}
+
+void operator delete(void* ptr) noexcept { deallocate(ptr, kDefaultAlignment); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr, kDefaultAlignment); }
+void operator delete(void* ptr, std::size_t) noexcept { deallocate(ptr, kDefaultAlignment); }
+void operator delete[](void* ptr, std::size_t) noexcept { deallocate(ptr, kDefaultAlignment); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  deallocate(ptr, kDefaultAlignment);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  deallocate(ptr, kDefaultAlignment);
+}
+void operator delete(void* ptr, std::align_val_t al) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
+void operator delete[](void* ptr, std::align_val_t al) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
+void operator delete(void* ptr, std::size_t, std::align_val_t al) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
+void operator delete[](void* ptr, std::size_t, std::align_val_t al) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
+void operator delete(void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
+void operator delete[](void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept {
+  deallocate(ptr, static_cast<size_t>(al));
+}
@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the material grid and service
+//
+#include <algorithms/material.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#include <DDRec/MaterialManager.h>
+#include <DDRec/Vector3D.h>
+
+#include <algorithms/geo.h>
+#include <algorithms/profile.h>
+
+namespace algorithms {
+
+namespace {
+  constexpr std::array<char, 8> kMagic{'A', 'L', 'G', 'O', 'V', 'O', 'X', '\0'};
+  constexpr uint32_t kByteOrder = 0x01020304;
+  constexpr size_t kHeaderSize  = kMagic.size() + 2 * sizeof(uint32_t) + 6 * sizeof(double) +
+                                 6 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+  static_assert(kHeaderSize % alignof(float) == 0);
+
+  void validate(const MaterialGrid::Spec& spec) {
+    for (size_t d = 0; d < 3; ++d) {
+      if (spec.nodes[d] < 2 || !(spec.max[d] > spec.min[d])) {
+        throw MaterialGridError(fmt::format(
+            "Invalid grid: axis {} needs at least 2 nodes (got {}) and max > min (got [{}, {}])",
+            d, spec.nodes[d], spec.min[d], spec.max[d]));
+      }
+    }
+  }
+} // namespace
+
+MaterialGrid::MaterialGrid(const Spec& spec) : m_spec{spec} {
+  validate(spec);
+  for (size_t d = 0; d < 3; ++d) {
+    m_spacing[d] = (spec.max[d] - spec.min[d]) / (spec.nodes[d] - 1);
+  }
+  m_owned.assign(spec.size() * kNChannels, 0.f);
+  m_values = m_owned;
+}
+
+MaterialGrid::MaterialGrid(const Spec& spec, std::unique_ptr<detail::MappedFile> file,
+                           gsl::span<const float> values)
+    : m_spec{spec}, m_file{std::move(file)}, m_values{values} {
+  for (size_t d = 0; d < 3; ++d) {
+    m_spacing[d] = (spec.max[d] - spec.min[d]) / (spec.nodes[d] - 1);
+  }
+}
+
+std::unique_ptr<const MaterialGrid> MaterialGrid::open(const std::string& path) {
+  auto file = std::make_unique<detail::MappedFile>(path);
+  try {
+    detail::ByteReader in{file->data(), file->size()};
+    if (std::memcmp(in.take(kMagic.size()), kMagic.data(), kMagic.size()) != 0) {
+      throw MaterialGridError("not a material grid");
+    }
+    if (in.read<uint32_t>() != kByteOrder) {
+      throw MaterialGridError("grid was written with a different byte order");
+    }
+    if (const auto version = in.read<uint32_t>(); version != kVersion) {
+      throw MaterialGridError(
+          fmt::format("unsupported version {} (expected {})", version, kVersion));
+    }
+    Spec spec;
+    for (auto& v : spec.min) {
+      v = in.read<double>();
+    }
+    for (auto& v : spec.max) {
+      v = in.read<double>();
+    }
+    for (auto& n : spec.nodes) {
+      n = in.read<uint32_t>();
+    }
+    validate(spec);
+    if (const auto nchannels = in.read<uint32_t>(); nchannels != kNChannels) {
+      throw MaterialGridError(
+          fmt::format("unexpected number of channels {} (expected {})", nchannels, kNChannels));
+    }
+    spec.subsamples   = in.read<uint32_t>();
+    spec.sample_field = in.read<uint32_t>() != 0;
+    spec.geometry     = in.read<uint64_t>();
+    const auto size     = in.read<uint64_t>();
+    const auto expected = in.read<uint64_t>();
+    if (size != file->size() - kHeaderSize || size != spec.size() * kNChannels * sizeof(float)) {
+      throw MaterialGridError("inconsistent payload size");
+    }
+    const auto* data = in.take(size);
+    if (detail::checksum(reinterpret_cast<const char*>(data), size) != expected) {
+      throw MaterialGridError("checksum mismatch");
+    }
+    // used in place, the mapping is page-aligned and the header size a multiple of 4
+    gsl::span<const float> values{reinterpret_cast<const float*>(data), spec.size() * kNChannels};
+    return std::unique_ptr<const MaterialGrid>(new MaterialGrid(spec, std::move(file), values));
+  } catch (const Error& e) {
+    throw MaterialGridError(fmt::format("Invalid material grid {}: {}", path, e.what()));
+  }
+}
+
+void MaterialGrid::write(const std::string& path) const {
+  const auto* data  = reinterpret_cast<const char*>(m_values.data());
+  const size_t size = m_values.size() * sizeof(float);
+
+  std::ofstream out{path, std::ios::binary};
+  if (!out) {
+    throw MaterialGridError(fmt::format("Failed to open {} to write the material grid", path));
+  }
+  out.write(kMagic.data(), kMagic.size());
+  detail::writeBinary(out, kByteOrder);
+  detail::writeBinary(out, kVersion);
+  for (const auto v : m_spec.min) {
+    detail::writeBinary(out, v);
+  }
+  for (const auto v : m_spec.max) {
+    detail::writeBinary(out, v);
+  }
+  for (const auto n : m_spec.nodes) {
+    detail::writeBinary(out, n);
+  }
+  detail::writeBinary(out, static_cast<uint32_t>(kNChannels));
+  detail::writeBinary(out, m_spec.subsamples);
+  detail::writeBinary(out, static_cast<uint32_t>(m_spec.sample_field));
+  detail::writeBinary(out, m_spec.geometry);
+  detail::writeBinary(out, static_cast<uint64_t>(size));
+  detail::writeBinary(out, detail::checksum(data, size));
+  out.write(data, size);
+}
+
+dd4hep::Position MaterialGrid::node(const uint32_t ix, const uint32_t iy,
+                                    const uint32_t iz) const {
+  return {m_spec.min[0] + ix * m_spacing[0], m_spec.min[1] + iy * m_spacing[1],
+          m_spec.min[2] + iz * m_spacing[2]};
+}
+
+void MaterialGrid::set(const uint32_t ix, const uint32_t iy, const uint32_t iz,
+                       const Values& values) {
+  if (m_owned.empty()) {
+    throw MaterialGridError("Cannot modify a memory-mapped material grid");
+  }
+  std::copy(values.begin(), values.end(), m_owned.begin() + offset(ix, iy, iz));
+}
+
+bool MaterialGrid::inside(const dd4hep::Position& pos) const {
+  const std::array<double, 3> p{pos.x(), pos.y(), pos.z()};
+  for (size_t d = 0; d < 3; ++d) {
+    if (!(p[d] >= m_spec.min[d] && p[d] <= m_spec.max[d])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MaterialGrid::Values MaterialGrid::at(const dd4hep::Position& pos) const {
+  Values ret{};
+  if (!inside(pos)) {
+    return ret;
+  }
+  // cell index and fractional position in the cell along each axis
+  const std::array<double, 3> p{pos.x(), pos.y(), pos.z()};
+  std::array<uint32_t, 3> i;
+  std::array<double, 3> f;
+  for (size_t d = 0; d < 3; ++d) {
+    const double u = (p[d] - m_spec.min[d]) / m_spacing[d];
+    i[d]           = std::min(static_cast<uint32_t>(u), m_spec.nodes[d] - 2);
+    f[d]           = u - i[d];
+  }
+  for (uint32_t corner = 0; corner < 8; ++corner) {
+    const uint32_t dx = corner & 1;
+    const uint32_t dy = (corner >> 1) & 1;
+    const uint32_t dz = (corner >> 2) & 1;
+    const double w    = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) * (dz ? f[2] : 1 - f[2]);
+    const float* v    = m_values.data() + offset(i[0] + dx, i[1] + dy, i[2] + dz);
+    for (size_t c = 0; c < kNChannels; ++c) {
+      ret[c] += static_cast<float>(w * v[c]);
+    }
+  }
+  return ret;
+}
+
+double MaterialGrid::materialBudget(const dd4hep::Position& from, const dd4hep::Position& to,
+                                    const Channel channel) const {
+  const dd4hep::Position delta = to - from;
+  const double length          = std::sqrt(delta.Mag2());
+  // midpoint rule with steps of at most half the smallest node spacing
+  const double step   = 0.5 * std::min({m_spacing[0], m_spacing[1], m_spacing[2]});
+  const size_t nsteps = std::max<size_t>(1, std::ceil(length / step));
+  double sum          = 0.;
+  for (size_t s = 0; s < nsteps; ++s) {
+    sum += at(from + delta * ((s + 0.5) / nsteps))[channel];
+  }
+  return sum * length / nsteps;
+}
+
+void MaterialSvc::init() {
+  MaterialGrid::Spec spec;
+  if (m_min.value().size() != 3 || m_max.value().size() != 3 || m_nodes.value().size() != 3) {
+    raise("gridMin, gridMax and gridNodes need exactly 3 values (x, y, z)");
+  }
+  for (size_t d = 0; d < 3; ++d) {
+    spec.min[d]   = m_min.value()[d];
+    spec.max[d]   = m_max.value()[d];
+    spec.nodes[d] = m_nodes.value()[d];
+  }
+  spec.subsamples   = m_subsamples;
+  spec.sample_field = m_sample_field;
+  const auto& geo   = GeoSvc::instance();
+  if (geo.hasDetector()) {
+    InitTimer timer{"material", "fingerprint"};
+    spec.geometry = geo.fingerprint();
+  }
+
+  const std::string& cache = m_cache_file.value();
+  struct stat st;
+  if (!cache.empty() && ::stat(cache.c_str(), &st) == 0) {
+    InitTimer timer{"material", "load"};
+    auto grid                   = MaterialGrid::open(cache);
+    const auto& cached          = grid->spec();
+    MaterialGrid::Spec expected = spec;
+    // without a full geometry (e.g. a snapshot) there is no fingerprint to compare with
+    if (!geo.hasDetector()) {
+      expected.geometry = cached.geometry;
+    }
+    if (cached == expected) {
+      info() << fmt::format("Loaded material grid from {}", cache) << endmsg;
+      m_grid = std::move(grid);
+      return;
+    }
+    std::string_view reason = "does not match the configured grid";
+    if (cached.geometry != expected.geometry) {
+      reason = "was sampled from another geometry";
+    } else if (cached.subsamples != expected.subsamples ||
+               cached.sample_field != expected.sample_field) {
+      reason = "was sampled with other settings";
+    }
+    warning() << fmt::format("Material grid in {} {}, sampling the geometry again", cache,
+                             reason)
+              << endmsg;
+  }
+
+  m_grid = build(spec);
+  if (!cache.empty()) {
+    m_grid->write(cache);
+    info() << fmt::format("Wrote material grid to {}", cache) << endmsg;
+  }
+}
+
+std::unique_ptr<const MaterialGrid> MaterialSvc::build(const MaterialGrid::Spec& spec) const {
+  const auto& geo = GeoSvc::instance();
+  if (geo.snapshot()) {
+    raise("Cannot sample the material grid: GeoSvc only maps a geometry snapshot, set the "
+          "cacheFile property to load a material grid instead");
+  }
+  if (!geo.hasDetector()) {
+    raise("Cannot sample the material grid: GeoSvc has no full detector geometry (only "
+          "subdetectors are loaded)");
+  }
+  const uint32_t nsub = spec.subsamples;
+  if (nsub == 0) {
+    raise("subsamples needs to be at least 1");
+  }
+  InitTimer timer{"material", "build"};
+  info() << fmt::format("Sampling material{} on {}x{}x{} grid nodes ({} lines per voxel face)",
+                        spec.sample_field ? " and field" : "", spec.nodes[0], spec.nodes[1],
+                        spec.nodes[2], nsub * nsub)
+         << endmsg;
+  // the material manager keeps its own navigator, so sampling is single-threaded
+  dd4hep::rec::MaterialManager materials{geo.world().volume()};
+  const auto field = geo.detector()->field();
+
+  // Each node stands for its voxel: the box of one node spacing centered on the node,
+  // clipped to the grid. Its material is the path-length weighted average over lines
+  // through the voxel along all three axes, so layers thinner than the node spacing
+  // contribute according to their thickness instead of being hit or missed by a single
+  // sampling point. Every line spans the full grid and is split into voxels using the
+  // thicknesses of the materials along it.
+  std::array<double, 3> spacing;
+  for (size_t d = 0; d < 3; ++d) {
+    spacing[d] = (spec.max[d] - spec.min[d]) / (spec.nodes[d] - 1);
+  }
+  const auto lower = [&](const size_t d, const uint32_t i) {
+    return std::max(spec.min[d], spec.min[d] + (i - 0.5) * spacing[d]);
+  };
+  const auto upper = [&](const size_t d, const uint32_t i) {
+    return std::min(spec.max[d], spec.min[d] + (i + 0.5) * spacing[d]);
+  };
+  const auto index = [&](const std::array<uint32_t, 3>& i) {
+    return (size_t(i[2]) * spec.nodes[1] + i[1]) * spec.nodes[0] + i[0];
+  };
+  // path length, and path-length weighted 1/X0, 1/lambda and density of each voxel
+  std::vector<double> path(spec.size(), 0.);
+  std::vector<double> inv_rad(spec.size(), 0.);
+  std::vector<double> inv_int(spec.size(), 0.);
+  std::vector<double> density(spec.size(), 0.);
+
+  for (size_t a = 0; a < 3; ++a) {
+    const size_t b = (a + 1) % 3;
+    const size_t c = (a + 2) % 3;
+    std::array<uint32_t, 3> node;
+    for (node[b] = 0; node[b] < spec.nodes[b]; ++node[b]) {
+      for (node[c] = 0; node[c] < spec.nodes[c]; ++node[c]) {
+        for (uint32_t sb = 0; sb < nsub; ++sb) {
+          for (uint32_t sc = 0; sc < nsub; ++sc) {
+            std::array<double, 3> from, to;
+            from[a] = spec.min[a];
+            to[a]   = spec.max[a];
+            from[b] = to[b] = lower(b, node[b]) +
+                              (sb + 0.5) / nsub * (upper(b, node[b]) - lower(b, node[b]));
+            from[c] = to[c] = lower(c, node[c]) +
+                              (sc + 0.5) / nsub * (upper(c, node[c]) - lower(c, node[c]));
+            const auto& segments =
+                materials.materialsBetween(dd4hep::rec::Vector3D(from[0], from[1], from[2]),
+                                           dd4hep::rec::Vector3D(to[0], to[1], to[2]));
+            // walk the segments and the voxels along the line together
+            double pos = spec.min[a];
+            node[a]    = 0;
+            for (const auto& [material, thickness] : segments) {
+              const double irad = 1. / material.radLength();
+              const double iint = 1. / material.intLength();
+              const double rho  = material.density();
+              const double end  = pos + thickness;
+              while (true) {
+                const bool last  = node[a] + 1 == spec.nodes[a];
+                const double cut = last ? end : std::min(end, upper(a, node[a]));
+                const double t   = cut - pos;
+                if (t > 0) {
+                  const size_t i = index(node);
+                  path[i] += t;
+                  inv_rad[i] += t * irad;
+                  inv_int[i] += t * iint;
+                  density[i] += t * rho;
+                }
+                pos = cut;
+                if (cut >= end) {
+                  break;
+                }
+                ++node[a];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  auto grid = std::make_unique<MaterialGrid>(spec);
+  for (uint32_t iz = 0; iz < spec.nodes[2]; ++iz) {
+    for (uint32_t iy = 0; iy < spec.nodes[1]; ++iy) {
+      for (uint32_t ix = 0; ix < spec.nodes[0]; ++ix) {
+        const size_t i = index({ix, iy, iz});
+        MaterialGrid::Values values{};
+        if (path[i] > 0) {
+          values[MaterialGrid::kInvRadLength] = inv_rad[i] / path[i];
+          values[MaterialGrid::kInvIntLength] = inv_int[i] / path[i];
+          values[MaterialGrid::kDensity]      = density[i] / path[i];
+        }
+        if (spec.sample_field) {
+          const auto b              = field.magneticField(grid->node(ix, iy, iz));
+          values[MaterialGrid::kBx] = b.x();
+          values[MaterialGrid::kBy] = b.y();
+          values[MaterialGrid::kBz] = b.z();
+        }
+        grid->set(ix, iy, iz, values);
+      }
+    }
+  }
+  return grid;
+}
+
+} // namespace algorithms
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the MemoryTracker, the allocation hooks are in hooks/memory_hooks.cpp
+//
+#include <algorithms/memory.h>
+
+namespace algorithms {
+
+namespace {
+  // set by the allocation hooks when they are linked into the executable
+  std::atomic<bool> g_hooked{false};
+} // namespace
+
+namespace detail {
+  thread_local MemoryStats* t_memory_scope = nullptr;
+
+  void registerAllocationHooks() { g_hooked.store(true, std::memory_order_relaxed); }
+} // namespace detail
+
+bool MemoryTracker::hooked() { return g_hooked.load(std::memory_order_relaxed); }
+
+} // namespace algorithms
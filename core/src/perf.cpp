@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the hardware performance counters
+//
+#include <algorithms/perf.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <limits>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithms/detail/csv.h>
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+namespace {
+  // perf event for each PerfStats::Counter, the first one is the group leader
+  constexpr std::array<uint64_t, PerfStats::kNCounters> kEvents{
+      PERF_COUNT_HW_CPU_CYCLES,          PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_REFERENCES,    PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+
+  double ratio(const uint64_t num, const uint64_t den) {
+    if (num == PerfCounters::kUnavailable || den == PerfCounters::kUnavailable || den == 0) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    return static_cast<double>(num) / den;
+  }
+} // namespace
+
+// Counter group of the calling thread, opened on first use and closed when the thread
+// exits
+struct PerfThreadCounters {
+  std::array<int, PerfStats::kNCounters> fds;
+  // position of each counter in the group read, -1 if not available
+  std::array<int, PerfStats::kNCounters> index;
+  size_t nopen = 0;
+  bool tried   = false;
+
+  PerfThreadCounters() {
+    fds.fill(-1);
+    index.fill(-1);
+  }
+  ~PerfThreadCounters() {
+    for (const int fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+  PerfThreadCounters(const PerfThreadCounters&) = delete;
+  void operator=(const PerfThreadCounters&) = delete;
+
+  bool open(PerfCounters& owner) {
+    tried = true;
+    for (size_t i = 0; i < PerfStats::kNCounters; ++i) {
+      perf_event_attr attr{};
+      attr.size           = sizeof(attr);
+      attr.type           = PERF_TYPE_HARDWARE;
+      attr.config         = kEvents[i];
+      attr.disabled       = i == 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv     = 1;
+      attr.read_format =
+          PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      // this thread, on any CPU
+      const int fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0],
+                               PERF_FLAG_FD_CLOEXEC);
+      if (fd < 0) {
+        if (i == 0) {
+          const int error   = errno;
+          const bool denied = error == EACCES || error == EPERM;
+          std::lock_guard<std::mutex> lock{owner.m_mutex};
+          owner.m_unavailable =
+              fmt::format("perf_event_open() failed for the cycle counter: {}{}",
+                          std::strerror(error),
+                          denied ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+          return false;
+        }
+        continue;
+      }
+      fds[i]   = fd;
+      index[i] = nopen++;
+      owner.m_available.fetch_or(1u << i, std::memory_order_relaxed);
+    }
+    ::ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+  }
+
+  bool read(PerfStats::Sample& sample) const {
+    // group read format: number of counters, time enabled, time running, counter values
+    std::array<uint64_t, 3 + PerfStats::kNCounters> buf;
+    const ssize_t n = ::read(fds[0], buf.data(), sizeof(buf));
+    if (n < static_cast<ssize_t>((3 + nopen) * sizeof(uint64_t))) {
+      return false;
+    }
+    // raw counts, scaling for multiplexing is done on the difference of two samples
+    sample.enabled = buf[1];
+    sample.running = buf[2];
+    for (size_t i = 0; i < PerfStats::kNCounters; ++i) {
+      sample.values[i] = index[i] < 0 ? PerfCounters::kUnavailable : buf[3 + index[i]];
+    }
+    return true;
+  }
+};
+
+namespace {
+  thread_local PerfThreadCounters t_perf_counters;
+} // namespace
+
+double PerfCounters::Record::ipc() const {
+  return ratio(values[PerfStats::kInstructions], values[PerfStats::kCycles]);
+}
+double PerfCounters::Record::cacheMissRate() const {
+  return ratio(values[PerfStats::kCacheMisses], values[PerfStats::kCacheReferences]);
+}
+double PerfCounters::Record::branchMissRate() const {
+  return ratio(values[PerfStats::kBranchMisses], values[PerfStats::kBranches]);
+}
+
+std::string PerfCounters::unavailable() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_unavailable;
+}
+
+PerfStats& PerfCounters::stats(std::string_view name) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto it = m_stats.find(name);
+  if (it == m_stats.end()) {
+    it = m_stats.emplace(name, std::make_unique<PerfStats>(name)).first;
+  }
+  return *it->second;
+}
+
+bool PerfCounters::read(PerfStats::Sample& sample) {
+  auto& counters = t_perf_counters;
+  if (!counters.tried && !counters.open(*this)) {
+    return false;
+  }
+  return counters.fds[0] >= 0 && counters.read(sample);
+}
+
+std::vector<PerfCounters::Record> PerfCounters::records() const {
+  const uint32_t available = m_available.load(std::memory_order_relaxed);
+  std::vector<Record> ret;
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    for (const auto& [name, s] : m_stats) {
+      if (s->calls() == 0 && s->unscheduledCalls() == 0) {
+        continue;
+      }
+      Record r{name, s->calls(), s->unscheduledCalls(), {}};
+      for (size_t i = 0; i < PerfStats::kNCounters; ++i) {
+        r.values[i] = (available >> i) & 1 ? s->value(static_cast<PerfStats::Counter>(i))
+                                           : kUnavailable;
+      }
+      ret.push_back(std::move(r));
+    }
+  }
+  std::stable_sort(ret.begin(), ret.end(), [](const Record& a, const Record& b) {
+    return a.values[PerfStats::kCycles] > b.values[PerfStats::kCycles];
+  });
+  return ret;
+}
+
+std::string PerfCounters::report() const {
+  if (const auto reason = unavailable(); !reason.empty()) {
+    return fmt::format("Hardware performance counters not available: {}\n", reason);
+  }
+  std::string ret = fmt::format("{:<40} {:>10} {:>12} {:>14} {:>14} {:>6} {:>12} {:>12}\n",
+                                "name", "calls", "unscheduled", "cycles/call", "instr/call", "IPC",
+                                "cache miss", "branch miss");
+  uint64_t unscheduled = 0;
+  for (const auto& r : records()) {
+    unscheduled += r.unscheduled;
+    const auto perCall = [&](const PerfStats::Counter c) {
+      return r.values[c] == kUnavailable || r.calls == 0
+                 ? std::string{"n/a"}
+                 : fmt::format("{:.0f}", double(r.values[c]) / r.calls);
+    };
+    const auto rate = [](const double v) {
+      return std::isnan(v) ? std::string{"n/a"} : fmt::format("{:.2f}%", 100 * v);
+    };
+    const double ipc = r.ipc();
+    ret += fmt::format("{:<40} {:>10} {:>12} {:>14} {:>14} {:>6} {:>12} {:>12}\n", r.name,
+                       r.calls, r.unscheduled, perCall(PerfStats::kCycles),
+                       perCall(PerfStats::kInstructions),
+                       std::isnan(ipc) ? std::string{"n/a"} : fmt::format("{:.2f}", ipc),
+                       rate(r.cacheMissRate()), rate(r.branchMissRate()));
+  }
+  if (unscheduled > 0) {
+    ret += fmt::format("{} scopes were not counted, the counters were never scheduled on the "
+                       "PMU (e.g. held by the NMI watchdog or other perf users)\n",
+                       unscheduled);
+  }
+  return ret;
+}
+
+void PerfCounters::write(const std::string& path) const {
+  std::ofstream out{path};
+  if (!out) {
+    throw Error(fmt::format("Failed to open {} to write the performance counters", path),
+                "algorithms::PerfCounters");
+  }
+  // unavailable counters are left empty
+  const auto value = [](const uint64_t v) {
+    return v == kUnavailable ? std::string{} : std::to_string(v);
+  };
+  out << "name,calls,unscheduled,cycles,instructions,cache_references,cache_misses,branches,"
+         "branch_misses\n";
+  for (const auto& r : records()) {
+    out << fmt::format("{},{},{}", detail::csvField(r.name), r.calls, r.unscheduled);
+    for (const auto v : r.values) {
+      out << ',' << value(v);
+    }
+    out << '\n';
+  }
+}
+
+} // namespace algorithms
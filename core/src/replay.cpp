@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the columnar event file used for algorithm replay
+//
+#include <algorithms/replay.h>
+
+#include <array>
+#include <fstream>
+#include <sstream>
+
+namespace algorithms {
+
+namespace {
+  constexpr std::array<char, 8> kMagic{'A', 'L', 'G', 'O', 'E', 'V', 'T', '\0'};
+  constexpr uint32_t kByteOrder = 0x01020304;
+  constexpr size_t kHeaderSize  = kMagic.size() + 3 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+} // namespace
+
+void EventFile::write(const std::string& path, const std::vector<ColumnData>& columns) {
+  const size_t nevents = columns.empty() ? 0 : columns.front().offsets.size() - 1;
+
+  std::ostringstream payload;
+  for (const auto& column : columns) {
+    if (column.offsets.size() != nevents + 1 || column.offsets.back() != column.data.size()) {
+      throw EventFileError(
+          fmt::format("Inconsistent number of events in column {}", column.name));
+    }
+    detail::writeBinaryString(payload, column.name);
+    detail::writeBinaryString(payload, column.type);
+    detail::writeBinary(payload, column.value_size);
+    detail::writeBinary(payload, static_cast<uint64_t>(column.data.size()));
+    const size_t pad = padding(kHeaderSize + static_cast<size_t>(payload.tellp()));
+    payload.write(std::array<char, kAlignment>{}.data(), pad);
+    payload.write(reinterpret_cast<const char*>(column.offsets.data()),
+                  column.offsets.size() * sizeof(uint64_t));
+    payload.write(column.data.data(), column.data.size());
+  }
+  const std::string data = payload.str();
+
+  std::ofstream out{path, std::ios::binary};
+  if (!out) {
+    throw EventFileError(fmt::format("Failed to open {} to write the event file", path));
+  }
+  out.write(kMagic.data(), kMagic.size());
+  detail::writeBinary(out, kByteOrder);
+  detail::writeBinary(out, kVersion);
+  detail::writeBinary(out, static_cast<uint32_t>(columns.size()));
+  detail::writeBinary(out, static_cast<uint64_t>(nevents));
+  detail::writeBinary(out, static_cast<uint64_t>(data.size()));
+  detail::writeBinary(out, detail::checksum(data.data(), data.size()));
+  out.write(data.data(), data.size());
+}
+
+EventFile::EventFile(const std::string& path) : m_file{path} {
+  try {
+    detail::ByteReader in{m_file.data(), m_file.size()};
+    if (std::memcmp(in.take(kMagic.size()), kMagic.data(), kMagic.size()) != 0) {
+      throw EventFileError("not an event file");
+    }
+    if (in.read<uint32_t>() != kByteOrder) {
+      throw EventFileError("event file was written with a different byte order");
+    }
+    if (const auto version = in.read<uint32_t>(); version != kVersion) {
+      throw EventFileError(
+          fmt::format("unsupported version {} (expected {})", version, kVersion));
+    }
+    const auto ncolumns = in.read<uint32_t>();
+    m_nevents           = in.read<uint64_t>();
+    const auto size     = in.read<uint64_t>();
+    const auto expected = in.read<uint64_t>();
+    if (size != m_file.size() - kHeaderSize || m_nevents > size / sizeof(uint64_t)) {
+      throw EventFileError("inconsistent payload size");
+    }
+    if (detail::checksum(reinterpret_cast<const char*>(m_file.data()) + kHeaderSize, size) !=
+        expected) {
+      throw EventFileError("checksum mismatch");
+    }
+    // the data is used in place, only the event offsets are validated
+    m_columns.reserve(ncolumns);
+    for (uint32_t i = 0; i < ncolumns; ++i) {
+      Column column;
+      column.name       = in.readString();
+      column.type       = in.readString();
+      column.value_size = in.read<uint32_t>();
+      const auto ndata  = in.read<uint64_t>();
+      in.take(padding(in.position()));
+      const auto* offsets = in.take((m_nevents + 1) * sizeof(uint64_t));
+      column.offsets      = {reinterpret_cast<const uint64_t*>(offsets), m_nevents + 1};
+      column.data         = {in.take(ndata), ndata};
+      for (size_t e = 0; e < m_nevents; ++e) {
+        if (column.offsets[e] > column.offsets[e + 1] || column.offsets[e] % kAlignment != 0) {
+          throw EventFileError(fmt::format("invalid event offsets in column {}", column.name));
+        }
+      }
+      if (column.offsets[0] != 0 || column.offsets[m_nevents] != ndata) {
+        throw EventFileError(fmt::format("invalid event offsets in column {}", column.name));
+      }
+      m_columns.push_back(column);
+    }
+    if (!in.done()) {
+      throw EventFileError("trailing data after last column");
+    }
+  } catch (const Error& e) {
+    throw EventFileError(fmt::format("Invalid event file {}: {}", path, e.what()));
+  }
+}
+
+const EventFile::Column& EventFile::column(std::string_view name, std::string_view type) const {
+  for (const auto& column : m_columns) {
+    if (column.name == name) {
+      if (column.type != type) {
+        throw EventFileError(
+            fmt::format("column {} has values of type {}, expected {}", name, column.type, type));
+      }
+      return column;
+    }
+  }
+  throw EventFileError(fmt::format("no column {}", name));
+}
+
+} // namespace algorithms
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the service service
+//
+#include <algorithms/service.h>
+
+#include <algorithms/memory.h>
+#include <algorithms/profile.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace algorithms {
+
+void ServiceSvc::init(const size_t nthreads) {
+  // ensure we only call init once
+  if (m_init) {
+    throw ServiceError("Cannot initialize services twice");
+  }
+  // The service list is not modified until we are done, registrations are rejected (see add())
+  struct InitGuard {
+    ServiceSvc& svc;
+    explicit InitGuard(ServiceSvc& s) : svc{s} {
+      std::lock_guard<std::mutex> lock{svc.m_mutex};
+      if (svc.m_initializing) {
+        throw ServiceError("Cannot initialize services twice");
+      }
+      svc.m_initializing = true;
+    }
+    ~InitGuard() {
+      std::lock_guard<std::mutex> lock{svc.m_mutex};
+      svc.m_initializing = false;
+    }
+  } guard{*this};
+
+  // Build the dependency graph: number of pending dependencies for each service, and
+  // the services that depend on each service
+  std::map<std::string_view, size_t> index;
+  for (size_t i = 0; i < m_keys.size(); ++i) {
+    index[m_keys[i]] = i;
+  }
+  std::vector<size_t> pending(m_keys.size(), 0);
+  std::vector<std::vector<size_t>> dependents(m_keys.size());
+  for (size_t i = 0; i < m_keys.size(); ++i) {
+    for (const auto& dep : dependencies(m_keys[i])) {
+      if (!index.count(dep)) {
+        throw ServiceError(
+            fmt::format("Service {} depends on unknown service {}", m_keys[i], dep));
+      }
+      ++pending[i];
+      dependents[index[dep]].push_back(i);
+    }
+  }
+  // Detect circular dependencies before starting
+  {
+    auto todo = pending;
+    std::vector<size_t> queue;
+    for (size_t i = 0; i < todo.size(); ++i) {
+      if (todo[i] == 0) {
+        queue.push_back(i);
+      }
+    }
+    for (size_t n = 0; n < queue.size(); ++n) {
+      for (const auto i : dependents[queue[n]]) {
+        if (--todo[i] == 0) {
+          queue.push_back(i);
+        }
+      }
+    }
+    if (queue.size() != m_keys.size()) {
+      std::vector<std::string_view> cycle;
+      for (size_t i = 0; i < todo.size(); ++i) {
+        if (todo[i] > 0) {
+          cycle.push_back(m_keys[i]);
+        }
+      }
+      throw ServiceError(fmt::format("Circular service dependencies between {}", cycle));
+    }
+  }
+
+  // Ready services, ordered by registration so single-threaded running keeps the
+  // registration order whenever dependencies allow
+  std::set<size_t> ready;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (pending[i] == 0) {
+      ready.insert(i);
+    }
+  }
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t running = 0;
+  bool failed    = false;
+  std::string failure;
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      cv.wait(lock, [&] { return failed || !ready.empty() || running == 0; });
+      // we encountered an issue (stop here so validation fails), or we are done
+      if (failed || ready.empty()) {
+        break;
+      }
+      const size_t i = *ready.begin();
+      ready.erase(ready.begin());
+      ++running;
+      lock.unlock();
+      const auto error = initService(m_keys[i]);
+      lock.lock();
+      --running;
+      if (!error.empty()) {
+        if (!failed) {
+          failure = fmt::format("{}: {}", m_keys[i], error);
+        }
+        failed = true;
+      } else {
+        for (const auto j : dependents[i]) {
+          if (--pending[j] == 0) {
+            ready.insert(j);
+          }
+        }
+      }
+      cv.notify_all();
+    }
+  };
+  if (nthreads <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < std::min(nthreads, m_keys.size()); ++i) {
+      pool.emplace_back(worker);
+    }
+    for (auto& thread : pool) {
+      thread.join();
+    }
+  }
+
+  // Validate all services in case we encountered issues so we get useful error
+  // reporting, with the reason of the first failure
+  if (failed) {
+    try {
+      validate();
+    } catch (const ServiceError& e) {
+      throw ServiceError(fmt::format("{}Failed to initialize service {}", e.what(), failure));
+    }
+    throw ServiceError(fmt::format("Failed to initialize service {}", failure));
+  }
+  validate();
+
+  // Label initialization as complete
+  m_init = true;
+}
+
+std::string ServiceSvc::initService(std::string_view name) {
+  try {
+    InitTimer timer{"service", name};
+    MemoryScope memory{name};
+    m_initializers.at(name)();
+  } catch (const std::exception& e) {
+    return e.what();
+  }
+  auto svc = m_services.at(name);
+  // Ensure our init made sense -- cannot have missing properties at this stage
+  if (const auto missing = svc->missingProperties(); !missing.empty()) {
+    return fmt::format("missing properties {}", missing);
+  }
+  svc->ready(true);
+  return {};
+}
+
+} // namespace algorithms
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright (C) 2022 Wouter Deconinck, Sylvester Joosten
+//
+// Implementation of the execution timeline tracer
+//
+#include <algorithms/trace.h>
+
+#include <fmt/format.h>
+#include <fstream>
+#include <unistd.h>
+
+#include <algorithms/error.h>
+
+namespace algorithms {
+
+namespace {
+  // Buffer of the running thread, registered with the tracer on first use
+  thread_local void* t_trace_buffer = nullptr;
+
+  std::string escape(std::string_view str) {
+    std::string ret;
+    for (const char c : str) {
+      if (c == '"' || c == '\\') {
+        ret += '\\';
+        ret += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        ret += fmt::format("\\u{:04x}", static_cast<int>(c));
+      } else {
+        ret += c;
+      }
+    }
+    return ret;
+  }
+} // namespace
+
+uint32_t Tracer::intern(std::string_view name) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const auto it = m_ids.find(name);
+  if (it != m_ids.end()) {
+    return it->second;
+  }
+  const auto id = static_cast<uint32_t>(m_names.size());
+  m_names.emplace_back(name);
+  m_ids.emplace(name, id);
+  return id;
+}
+
+Tracer::ThreadBuffer& Tracer::buffer() {
+  if (!t_trace_buffer) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_buffers.push_back(std::make_unique<ThreadBuffer>(m_buffers.size()));
+    t_trace_buffer = m_buffers.back().get();
+  }
+  return *static_cast<ThreadBuffer*>(t_trace_buffer);
+}
+
+void Tracer::record(const Event& event) {
+  auto& buf   = buffer();
+  size_t size = buf.tail->size.load(std::memory_order_relaxed);
+  if (size == Chunk::kSize) {
+    // continue in a new chunk, the full one stays in place for readers
+    buf.chunks.push_back(std::make_unique<Chunk>());
+    buf.tail->next.store(buf.chunks.back().get(), std::memory_order_release);
+    buf.tail = buf.chunks.back().get();
+    size     = 0;
+  }
+  buf.tail->events[size] = event;
+  // publish the event to readers on other threads
+  buf.tail->size.store(size + 1, std::memory_order_release);
+}
+
+size_t Tracer::size() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  size_t n = 0;
+  for (const auto& buf : m_buffers) {
+    for (const Chunk* c = buf->head.get(); c; c = c->next.load(std::memory_order_acquire)) {
+      n += c->size.load(std::memory_order_acquire);
+    }
+  }
+  return n;
+}
+
+void Tracer::write(const std::string& path) const {
+  std::ofstream out{path};
+  if (!out) {
+    throw Error(fmt::format("Failed to open {} to write the trace", path), "algorithms::Tracer");
+  }
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const int pid = ::getpid();
+  // Chrome trace format: complete events ("X") with timestamps and durations in
+  // microseconds, and a metadata event ("M") with the name of each thread
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  for (const auto& buf : m_buffers) {
+    out << fmt::format("{}\n{{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": {}, "
+                       "\"tid\": {}, \"args\": {{\"name\": \"thread {}\"}}}}",
+                       first ? "" : ",", pid, buf->id, buf->id);
+    first = false;
+    for (const Chunk* c = buf->head.get(); c; c = c->next.load(std::memory_order_acquire)) {
+      const size_t n = c->size.load(std::memory_order_acquire);
+      for (size_t i = 0; i < n; ++i) {
+        const auto& e = c->events[i];
+        out << fmt::format(",\n{{\"ph\": \"X\", \"name\": \"{}\", \"cat\": \"{}\", \"pid\": {}, "
+                           "\"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+                           escape(m_names[e.name]), escape(m_names[e.category]), pid, buf->id,
+                           e.begin_ns * 1e-3, (e.end_ns - e.begin_ns) * 1e-3);
+      }
+    }
+  }
+  out << "\n]}\n";
+}
+
+} // namespace algorithms